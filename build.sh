@@ -7,6 +7,22 @@ if [ ! -d ./build ]; then
     mkdir ./build
 fi
 
-$cc $cflags -o ./build/hxr-emu ./hxr-emu.c ./hxr.c
-$cc $cflags -o ./build/hxr-asm ./hxr-asm.c ./hxr.c
+# libhxr
+$cc $cflags -fPIC -c -o ./build/hxr.o ./hxr.c
+$cc $cflags -fPIC -c -o ./build/hxr_sched.o ./hxr_sched.c
+$cc $cflags -fPIC -c -o ./build/hxr_stats.o ./hxr_stats.c
+$cc $cflags -fPIC -c -o ./build/hxr_cfg.o ./hxr_cfg.c
+ar rcs ./build/libhxr.a ./build/hxr.o ./build/hxr_sched.o ./build/hxr_stats.o ./build/hxr_cfg.o
+$cc -shared -o ./build/libhxr.so ./build/hxr.o ./build/hxr_sched.o ./build/hxr_stats.o ./build/hxr_cfg.o
+
+$cc $cflags -pthread -o ./build/hxr-emu ./hxr-emu.c ./build/libhxr.a
+$cc $cflags -o ./build/hxr-asm ./hxr-asm.c ./build/libhxr.a
+$cc $cflags -o ./build/hxr-client ./hxr-client.c
+$cc $cflags -o ./build/hxr-stat ./hxr-stat.c ./build/libhxr.a
+$cc $cflags -o ./build/hxr-fuzz ./hxr-fuzz.c ./build/libhxr.a
+$cc $cflags -o ./build/hxr-dis ./hxr-dis.c ./build/libhxr.a
 ./build/hxr-asm ./tests/basic.hxr ./tests/basic.hxs
+./build/hxr-asm ./tests/branches.hxr ./tests/branches.hxs
+# branches.hxs halts with r6 = 15 and r7 = 11 only when every jump works
+./build/hxr-emu ./tests/branches.hxr | grep -q '^R6(15)$'
+./build/hxr-emu ./tests/branches.hxr | grep -q '^R7(11)$'
@@ -6,10 +6,12 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdarg.h>
+#include <string.h>
 
 void usage(FILE* f, const char* name)
 {
-    fprintf(f, "USAGE: %s [output] [src]\n", name);
+    fprintf(f, "USAGE: %s [-g] [output] [src]\n", name);
+    fprintf(f, "    -g    also write the line table `output.lines` and the listing `output.lst`\n");
 }
 
 void trap(const char* fmt, ...)
@@ -44,7 +46,25 @@ int load_file_data(FILE* f, char* result)
     return read_sz;
 }
 
-uint16_t parse_instruction(String_View op, String_View a1, String_View a2)
+typedef struct {
+    String_View name;
+    uint16_t addr;
+} Label;
+
+typedef da(Label) Labels;
+
+bool find_label(Labels* labels, String_View name, uint16_t* addr)
+{
+    for(size_t i = 0; i < labels->count; ++i) {
+        if(labels->data[i].name.count == name.count && sv_eq(labels->data[i].name, name)) {
+            *addr = labels->data[i].addr;
+            return true;
+        }
+    }
+    return false;
+}
+
+uint16_t parse_instruction(String_View op, String_View a1, String_View a2, Labels* labels)
 {
     uint16_t inst = 0;
     if(sv_eq(op, sv_from_cstr("mov"))) {
@@ -131,6 +151,158 @@ uint16_t parse_instruction(String_View op, String_View a1, String_View a2)
             int r = sv_to_int(a2);
             inst |= r << 8;
         }
+    } else if(sv_eq(op, sv_from_cstr("xchg")) || sv_eq(op, sv_from_cstr("cas"))
+            || sv_eq(op, sv_from_cstr("mcpy")) || sv_eq(op, sv_from_cstr("mset"))) {
+        if(sv_eq(op, sv_from_cstr("xchg"))) inst |= XCHG;
+        else if(sv_eq(op, sv_from_cstr("cas"))) inst |= CAS;
+        else if(sv_eq(op, sv_from_cstr("mcpy"))) inst |= MCPY;
+        else inst |= MSET;
+        if(a1.count == 2 && a1.data[0] == 'r' && __common_isdigit(a1.data[1])) {
+            inst |= (a1.data[1] - '0') << 5;
+        } else {
+            trap("The 1st argument of instruction "SV_FMT" should be a register", SV_ARGV(op));
+        }
+        if(a2.count == 2 && a2.data[0] == 'r' && __common_isdigit(a2.data[1])) {
+            inst |= (a2.data[1] - '0') << 8;
+        } else {
+            trap("The 2nd argument of instruction "SV_FMT" should be a register", SV_ARGV(op));
+        }
+    } else if(sv_eq(op, sv_from_cstr("cid")) || sv_eq(op, sv_from_cstr("alloc"))
+            || sv_eq(op, sv_from_cstr("free"))) {
+        inst |= SYS;
+        if(sv_eq(op, sv_from_cstr("cid"))) inst |= SYS_CORE_ID << 8;
+        else if(sv_eq(op, sv_from_cstr("alloc"))) inst |= SYS_ALLOC << 8;
+        else inst |= SYS_FREE << 8;
+        if(a1.count == 2 && a1.data[0] == 'r' && __common_isdigit(a1.data[1])) {
+            inst |= (a1.data[1] - '0') << 5;
+        } else {
+            trap("The 1st argument of instruction "SV_FMT" should be a register", SV_ARGV(op));
+        }
+    } else if(sv_eq(op, sv_from_cstr("rdcyc")) || sv_eq(op, sv_from_cstr("rdret"))) {
+        inst |= SYS;
+        if(a1.count == 2 && a1.data[0] == 'r' && __common_isdigit(a1.data[1])) {
+            inst |= (a1.data[1] - '0') << 5;
+        } else {
+            trap("The 1st argument of instruction "SV_FMT" should be a register", SV_ARGV(op));
+        }
+        // the optional 2nd argument picks the 16 bit word of the 64 bit counter
+        int word = a2.count > 0 ? sv_to_int(a2) : 0;
+        if(word < 0 || word > 3) {
+            trap("The 2nd argument of instruction "SV_FMT" should be between 0 and 3", SV_ARGV(op));
+            word = 0;
+        }
+        inst |= ((sv_eq(op, sv_from_cstr("rdcyc")) ? SYS_CYCLES : SYS_RETIRED) + word) << 8;
+    } else if(sv_eq(op, sv_from_cstr("and")) || sv_eq(op, sv_from_cstr("or")) || sv_eq(op, sv_from_cstr("xor"))
+            || sv_eq(op, sv_from_cstr("ldw")) || sv_eq(op, sv_from_cstr("stw"))
+            || sv_eq(op, sv_from_cstr("ldb")) || sv_eq(op, sv_from_cstr("stb"))) {
+        if(sv_eq(op, sv_from_cstr("and"))) inst |= AND;
+        else if(sv_eq(op, sv_from_cstr("or"))) inst |= OR;
+        else if(sv_eq(op, sv_from_cstr("xor"))) inst |= XOR;
+        else if(sv_eq(op, sv_from_cstr("ldw"))) inst |= LDW;
+        else if(sv_eq(op, sv_from_cstr("stw"))) inst |= STW;
+        else if(sv_eq(op, sv_from_cstr("ldb"))) inst |= LDB;
+        else inst |= STB;
+        if(a1.count == 2 && a1.data[0] == 'r' && __common_isdigit(a1.data[1])) {
+            inst |= (a1.data[1] - '0') << 5;
+        } else {
+            trap("The 1st argument of instruction "SV_FMT" should be a register", SV_ARGV(op));
+        }
+        if(a2.count == 2 && a2.data[0] == 'r' && __common_isdigit(a2.data[1])) {
+            inst |= (a2.data[1] - '0') << 8;
+        } else {
+            trap("The 2nd argument of instruction "SV_FMT" should be a register", SV_ARGV(op));
+        }
+    } else if(sv_eq(op, sv_from_cstr("bsl")) || sv_eq(op, sv_from_cstr("bsr"))) {
+        bool left = sv_eq(op, sv_from_cstr("bsl"));
+        if(a1.count == 2 && a1.data[0] == 'r' && __common_isdigit(a1.data[1])) {
+            inst |= (a1.data[1] - '0') << 5;
+        } else {
+            trap("The 1st argument of instruction "SV_FMT" should be a register", SV_ARGV(op));
+        }
+        if(a2.count <= 0) {
+            trap("The 2nd argument of instruction "SV_FMT" should be either registers or immediate value", SV_ARGV(op));
+        } else if(a2.data[0] == 'r') {
+            inst |= left ? BSL : BSR;
+            inst |= (a2.data[1] - '0') << 8;
+        } else {
+            inst |= left ? BSLI : BSRI;
+            inst |= sv_to_int(a2) << 8;
+        }
+    } else if(sv_eq(op, sv_from_cstr("push"))) {
+        // pushes the immediate, not a register
+        int value = a1.count > 0 ? sv_to_int(a1) : -1;
+        if(value < 0 || value > 0x7ff) {
+            trap("The argument of instruction "SV_FMT" should be between 0 and 2047", SV_ARGV(op));
+            value = 0;
+        }
+        inst = PUSH | value << 5;
+    } else if(sv_eq(op, sv_from_cstr("pop"))) {
+        inst |= POP;
+        if(a1.count == 2 && a1.data[0] == 'r' && __common_isdigit(a1.data[1])) {
+            inst |= (a1.data[1] - '0') << 5;
+        } else {
+            trap("The 1st argument of instruction "SV_FMT" should be a register", SV_ARGV(op));
+        }
+    } else if(sv_eq(op, sv_from_cstr("sys"))) {
+        // any SYS function, including the ones handled by a host callback
+        inst |= SYS;
+        if(a1.count == 2 && a1.data[0] == 'r' && __common_isdigit(a1.data[1])) {
+            inst |= (a1.data[1] - '0') << 5;
+        } else {
+            trap("The 1st argument of instruction "SV_FMT" should be a register", SV_ARGV(op));
+        }
+        inst |= (sv_to_int(a2) & 0xff) << 8;
+    } else if(sv_eq(op, sv_from_cstr("brk"))) {
+        inst = HXR_BREAKPOINT;
+    } else if(sv_eq(op, sv_from_cstr("dw"))) {
+        // a raw word, for data and encodings the mnemonics do not produce
+        inst = (uint16_t)sv_to_int(a1);
+    } else if(sv_eq(op, sv_from_cstr("map"))) {
+        inst |= SYS;
+        if(a1.count == 2 && a1.data[0] == 'r' && __common_isdigit(a1.data[1])) {
+            inst |= (a1.data[1] - '0') << 5;
+        } else {
+            trap("The 1st argument of instruction "SV_FMT" should be a register", SV_ARGV(op));
+        }
+        int slot = a2.count > 0 ? sv_to_int(a2) : -1;
+        if(slot < 0 || slot >= HXR_BANK_SLOTS) {
+            trap("The 2nd argument of instruction "SV_FMT" should be a slot between 0 and 3", SV_ARGV(op));
+            slot = 0;
+        }
+        inst |= (SYS_MAP + slot) << 8;
+    } else if(sv_eq(op, sv_from_cstr("cmp"))) {
+        inst |= CMP;
+        if(a1.count == 2 && a1.data[0] == 'r' && __common_isdigit(a1.data[1])) {
+            inst |= (a1.data[1] - '0') << 5;
+        } else {
+            trap("The 1st argument of instruction "SV_FMT" should be a register", SV_ARGV(op));
+        }
+        if(a2.count == 2 && a2.data[0] == 'r' && __common_isdigit(a2.data[1])) {
+            inst |= (a2.data[1] - '0') << 8;
+        } else {
+            trap("The 2nd argument of instruction "SV_FMT" should be a register", SV_ARGV(op));
+        }
+    } else if(op.count == 2 && (sv_eq(op, sv_from_cstr("je")) || sv_eq(op, sv_from_cstr("jn"))
+            || sv_eq(op, sv_from_cstr("jl")) || sv_eq(op, sv_from_cstr("jg")))) {
+        if(sv_eq(op, sv_from_cstr("je"))) inst |= JE;
+        else if(sv_eq(op, sv_from_cstr("jn"))) inst |= JN;
+        else if(sv_eq(op, sv_from_cstr("jl"))) inst |= JL;
+        else inst |= JG;
+        // a label, or the address of the target
+        uint16_t addr = 0;
+        if(a1.count > 0 && __common_isdigit(a1.data[0])) {
+            addr = (uint16_t)sv_to_int(a1);
+            if(addr < HXR_INSTRUCTIONS_START || addr & 1) {
+                trap("Address "SV_FMT" is not an instruction", SV_ARGV(a1));
+            }
+        } else if(!find_label(labels, a1, &addr)) {
+            trap("Unknown label "SV_FMT, SV_ARGV(a1));
+        }
+        uint16_t index = (addr - HXR_INSTRUCTIONS_START) / 2;
+        if(index > 0x7ff) {
+            trap("Label "SV_FMT" is too far to jump to", SV_ARGV(a1));
+        }
+        inst |= (index & 0x7ff) << 5;
     } else if(sv_eq(op, sv_from_cstr("hlt"))) {
         inst = HALT;
     } else {
@@ -140,27 +312,61 @@ uint16_t parse_instruction(String_View op, String_View a1, String_View a2)
     return inst;
 }
 
-uint16_t parse_line(String_View line)
+uint16_t parse_line(String_View line, Labels* labels)
 {
-    line = sv_rtrim(sv_ltrim(line));
     String_View op = sv_chop_by_delim(&line, ' ');
     String_View arg1 = sv_chop_by_delim(&line, ',');
-    return parse_instruction(op, arg1, sv_ltrim(line));
+    sv_chop_left_while(&arg1, __common_iswhitespace);
+    while(arg1.count > 0 && __common_iswhitespace(arg1.data[arg1.count - 1])) arg1.count -= 1;
+    sv_chop_left_while(&line, __common_iswhitespace);
+    return parse_instruction(op, arg1, line, labels);
 }
 
 typedef da(uint16_t) Program;
 
-Program parse_source(String_View source)
+// where every instruction came from
+typedef struct {
+    String_View text;
+    size_t line;
+} Source_Line;
+
+typedef struct {
+    Program insts;
+    da(Source_Line) lines;
+    Labels labels;
+} Assembly;
+
+// Lines hold one instruction or one `label:`, `;` starts a comment. Labels
+// are collected first so jumps can go forward.
+Assembly parse_source(String_View source)
 {
-    source = sv_rtrim(sv_ltrim(source));
-    String_View line = INVALID_SV;
-    Program insts = {0};
-    while(source.count > 0) {
-        line = sv_chop_by_delim(&source, '\n');
-        uint16_t inst = parse_line(line);
-        da_append(&insts, inst);
+    Assembly result = {0};
+    for(int pass = 0; pass < 2; ++pass) {
+        String_View rest = source;
+        uint16_t addr = HXR_INSTRUCTIONS_START;
+        for(size_t number = 1; rest.count > 0; ++number) {
+            String_View line = sv_chop_by_delim(&rest, '\n');
+            line = sv_chop_by_delim(&line, ';');
+            sv_chop_left_while(&line, __common_iswhitespace);
+            while(line.count > 0 && __common_iswhitespace(line.data[line.count - 1])) line.count -= 1;
+            if(line.count == 0) continue;
+
+            if(line.data[line.count - 1] == ':') {
+                if(pass == 0) {
+                    Label label = { sv_from_parts(line.data, line.count - 1), addr };
+                    da_append(&result.labels, label);
+                }
+                continue;
+            }
+            if(pass == 1) {
+                Source_Line source_line = { line, number };
+                da_append(&result.insts, parse_line(line, &result.labels));
+                da_append(&result.lines, source_line);
+            }
+            addr += 2;
+        }
     }
-    return insts;
+    return result;
 }
 
 void save_program_to_file(Program program, const char* filepath)
@@ -173,8 +379,56 @@ void save_program_to_file(Program program, const char* filepath)
     fclose(f);
 }
 
+// Line table, one entry per instruction:
+//     file <source path>
+//     <address> <line>
+//     label <name> <address>
+void save_line_table(Assembly* assembly, const char* src, const char* filepath)
+{
+    FILE* f = fopen(filepath, "w");
+    if(!f) {
+        trap("Failed to save into \"%s\"", filepath);
+        return;
+    }
+    fprintf(f, "file %s\n", src);
+    for(size_t i = 0; i < assembly->insts.count; ++i) {
+        fprintf(f, "%zu %zu\n", HXR_INSTRUCTIONS_START + i * 2, assembly->lines.data[i].line);
+    }
+    for(size_t i = 0; i < assembly->labels.count; ++i) {
+        Label label = assembly->labels.data[i];
+        fprintf(f, "label "SV_FMT" %u\n", SV_ARGV(label.name), label.addr);
+    }
+    fclose(f);
+}
+
+void save_listing(Assembly* assembly, const char* filepath)
+{
+    FILE* f = fopen(filepath, "w");
+    if(!f) {
+        trap("Failed to save into \"%s\"", filepath);
+        return;
+    }
+    size_t label = 0;
+    for(size_t i = 0; i < assembly->insts.count; ++i) {
+        uint16_t addr = HXR_INSTRUCTIONS_START + i * 2;
+        while(label < assembly->labels.count && assembly->labels.data[label].addr <= addr) {
+            fprintf(f, "%*s"SV_FMT":\n", 19, "", SV_ARGV(assembly->labels.data[label].name));
+            label += 1;
+        }
+        Source_Line line = assembly->lines.data[i];
+        fprintf(f, "%5u  %04x  %5zu      "SV_FMT"\n", addr, assembly->insts.data[i], line.line, SV_ARGV(line.text));
+    }
+    fclose(f);
+}
+
 int main(int argc, const char** argv)
 {
+    bool debug_info = false;
+    if(argc >= 2 && strcmp(argv[1], "-g") == 0) {
+        debug_info = true;
+        argc -= 1;
+        argv += 1;
+    }
     if(argc < 3) {
         fprintf(stderr, "ERROR: Please provide arguments\n");
         usage(stderr, argv[0]);
@@ -197,8 +451,18 @@ int main(int argc, const char** argv)
     }
     in_data[file_size] = '\0';
     String_View source = sv_from_parts(in_data, file_size);
-    Program program = parse_source(source);
-    save_program_to_file(program, out);
+    Assembly assembly = parse_source(source);
+    save_program_to_file(assembly.insts, out);
+    if(debug_info) {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s.lines", out);
+        save_line_table(&assembly, in, path);
+        snprintf(path, sizeof(path), "%s.lst", out);
+        save_listing(&assembly, path);
+    }
+    da_free(&assembly.insts);
+    da_free(&assembly.lines);
+    da_free(&assembly.labels);
     free(in_data);
 
     return 0;
@@ -0,0 +1,104 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Sends the same job to a `hxr-emu --serve <socket>` server over and over and
+// reports the round trip and server side latency percentiles.
+
+void usage(FILE* f, const char* name)
+{
+    fprintf(f, "USAGE: %s [socket] [rom] [jobs]\n", name);
+}
+
+uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+int compare_u64(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+uint64_t percentile(uint64_t* sorted, size_t count, double p)
+{
+    size_t i = (size_t)(p * (count - 1) + 0.5);
+    return sorted[i];
+}
+
+void report(const char* name, uint64_t* samples, size_t count)
+{
+    qsort(samples, count, sizeof(uint64_t), compare_u64);
+    printf("%-10s p50 %8.2fus  p99 %8.2fus  max %8.2fus\n", name,
+            percentile(samples, count, 0.50) / 1000.0,
+            percentile(samples, count, 0.99) / 1000.0,
+            samples[count - 1] / 1000.0);
+}
+
+int main(int argc, const char** argv)
+{
+    if(argc < 3) {
+        fprintf(stderr, "ERROR: Please provide arguments\n");
+        usage(stderr, argv[0]);
+        return 1;
+    }
+    size_t jobs = argc >= 4 ? (size_t)atol(argv[3]) : 10000;
+    if(jobs == 0) jobs = 1;
+
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    if(strlen(argv[1]) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "ERROR: Socket path is too long\n");
+        return 1;
+    }
+    strcpy(addr.sun_path, argv[1]);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "ERROR: Failed to connect to %s\n", argv[1]);
+        return 1;
+    }
+    FILE* in = fdopen(fd, "r");
+    FILE* out = fdopen(dup(fd), "w");
+
+    uint64_t* round_trip = (uint64_t*)malloc(jobs * sizeof(uint64_t));
+    uint64_t* server = (uint64_t*)malloc(jobs * sizeof(uint64_t));
+    char* line = NULL;
+    size_t cap = 0;
+    for(size_t i = 0; i < jobs; ++i) {
+        uint64_t start = now_ns();
+        fprintf(out, "rom=%s\n", argv[2]);
+        fflush(out);
+        if(getline(&line, &cap, in) <= 0) {
+            fprintf(stderr, "ERROR: Server closed the connection\n");
+            return 1;
+        }
+        round_trip[i] = now_ns() - start;
+        if(strncmp(line, "ok ", 3) != 0) {
+            fprintf(stderr, "ERROR: %s", line);
+            return 1;
+        }
+        const char* ns = strstr(line, " ns=");
+        server[i] = ns ? strtoull(ns + 4, NULL, 10) : 0;
+    }
+
+    printf("%zu jobs\n", jobs);
+    report("round trip", round_trip, jobs);
+    report("server", server, jobs);
+
+    free(line);
+    free(round_trip);
+    free(server);
+    fclose(in);
+    fclose(out);
+    return 0;
+}
@@ -0,0 +1,283 @@
+#include "hxr.h"
+#include "hxr_cfg.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void usage(FILE* f, const char* name)
+{
+    fprintf(f, "USAGE: %s [-s] [--dot] [rom]\n", name);
+    fprintf(f, "    -s       print the statistics instead of the listing\n");
+    fprintf(f, "    --dot    print the control flow graph for graphviz\n");
+}
+
+// Writes the instruction in the syntax of `hxr-asm`. Branch targets inside
+// the image become `L<address>` labels, others stay plain addresses. Words
+// with bits set that no mnemonic encodes are written as `dw`.
+void disassemble(uint16_t inst, size_t count, char* out, size_t size)
+{
+    static const char* names[32] = {
+        [MOV] = "mov", [MOVI] = "mov", [CMP] = "cmp", [JE] = "je", [JN] = "jn",
+        [JL] = "jl", [JG] = "jg", [ADD] = "add", [SUB] = "sub", [MOD] = "mod",
+        [ADDI] = "add", [SUBI] = "sub", [MODI] = "mod", [AND] = "and", [OR] = "or",
+        [XOR] = "xor", [BSL] = "bsl", [BSR] = "bsr", [BSLI] = "bsl", [BSRI] = "bsr",
+        [LDW] = "ldw", [STW] = "stw", [LDB] = "ldb", [STB] = "stb", [PUSH] = "push",
+        [POP] = "pop", [HALT] = "hlt", [XCHG] = "xchg", [CAS] = "cas", [MCPY] = "mcpy",
+        [MSET] = "mset", [SYS] = "sys",
+    };
+    uint16_t op = hxr_opcode(inst);
+    uint16_t used = 0xffff;
+    if(op == HALT) used = 0x001f;
+    else if(op == POP) used = 0x00ff;
+    else if(op == MOV || op == CMP || (op >= ADD && op <= MOD) || (op >= AND && op <= BSR)
+            || (op >= LDW && op <= STB) || (op >= XCHG && op <= MSET)) used = 0x07ff;
+    if(inst & ~used) {
+        snprintf(out, size, "dw %u", inst);
+        return;
+    }
+    switch(op) {
+        case MOVI: case ADDI: case SUBI: case MODI: case BSLI: case BSRI:
+            snprintf(out, size, "%s r%u, %u", names[op], hxr_ra(inst), hxr_imm_8(inst));
+            break;
+        case JE: case JN: case JL: case JG:
+            if(hxr_imm_11(inst) < count) snprintf(out, size, "%s L%u", names[op], hxr_branch_target(inst));
+            else snprintf(out, size, "%s %u", names[op], hxr_branch_target(inst));
+            break;
+        case PUSH:
+            snprintf(out, size, "push %u", hxr_imm_11(inst));
+            break;
+        case POP:
+            snprintf(out, size, "pop r%u", hxr_ra(inst));
+            break;
+        case HALT:
+            snprintf(out, size, "hlt");
+            break;
+        case SYS:
+            {
+                uint16_t func = hxr_imm_8(inst);
+                if(func == SYS_CORE_ID) snprintf(out, size, "cid r%u", hxr_ra(inst));
+                else if(func == SYS_ALLOC) snprintf(out, size, "alloc r%u", hxr_ra(inst));
+                else if(func == SYS_FREE) snprintf(out, size, "free r%u", hxr_ra(inst));
+                else if(func >= SYS_CYCLES && func < SYS_CYCLES + 4) snprintf(out, size, "rdcyc r%u, %u", hxr_ra(inst), func - SYS_CYCLES);
+                else if(func >= SYS_RETIRED && func < SYS_RETIRED + 4) snprintf(out, size, "rdret r%u, %u", hxr_ra(inst), func - SYS_RETIRED);
+                else if(func >= SYS_MAP && func < SYS_MAP + HXR_BANK_SLOTS) snprintf(out, size, "map r%u, %u", hxr_ra(inst), func - SYS_MAP);
+                else if(inst == HXR_BREAKPOINT) snprintf(out, size, "brk");
+                else snprintf(out, size, "sys r%u, %u", hxr_ra(inst), func);
+            } break;
+        default:
+            snprintf(out, size, "%s r%u, r%u", names[op], hxr_ra(inst), hxr_rb(inst));
+            break;
+    }
+}
+
+uint16_t* load_image(const char* path, size_t* count)
+{
+    FILE* f = fopen(path, "rb");
+    if(!f) return NULL;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if(size <= 0) {
+        fclose(f);
+        return NULL;
+    }
+    // an odd trailing byte is padded into a full word
+    *count = (size + 1) / 2;
+    uint16_t* code = (uint16_t*)calloc(*count, sizeof(uint16_t));
+    if(code && fread(code, 1, size, f) != (size_t)size) {
+        free(code);
+        code = NULL;
+    }
+    fclose(f);
+    return code;
+}
+
+void print_listing(const HXR_Cfg* cfg)
+{
+    uint8_t* targets = (uint8_t*)calloc(cfg->count, 1);
+    for(size_t i = 0; i < cfg->count; ++i) {
+        uint16_t op = hxr_opcode(cfg->code[i]);
+        if(op < JE || op > JG) continue;
+        size_t target = (hxr_branch_target(cfg->code[i]) - HXR_INSTRUCTIONS_START) / 2;
+        if(target < cfg->count) targets[target] = 1;
+    }
+
+    for(size_t b = 0; b < cfg->block_count; ++b) {
+        const HXR_Block* block = &cfg->blocks[b];
+        size_t first = (block->start - HXR_INSTRUCTIONS_START) / 2;
+        if(targets[first]) printf("L%u:\n", block->start);
+        printf("    ; block %zu%s", b, block->reachable ? "" : ", unreachable");
+        if(block->loop == b) printf(", loop header");
+        else if(block->loop != HXR_CFG_NONE) printf(", in loop %u", cfg->blocks[block->loop].start);
+        if(block->falls_off) printf(", runs off the image");
+        printf("\n");
+
+        for(size_t i = first; i < first + block->count; ++i) {
+            char text[64];
+            disassemble(cfg->code[i], cfg->count, text, sizeof(text));
+            printf("    %-24s ; %5zu  %04x\n", text, HXR_INSTRUCTIONS_START + i * 2, cfg->code[i]);
+        }
+    }
+    free(targets);
+}
+
+void print_dot(const HXR_Cfg* cfg)
+{
+    printf("digraph cfg {\n");
+    printf("    node [shape=box fontname=monospace]\n");
+    for(size_t b = 0; b < cfg->block_count; ++b) {
+        const HXR_Block* block = &cfg->blocks[b];
+        printf("    b%zu [label=\"%u (%u)\"%s%s]\n", b, block->start, block->count,
+                block->reachable ? "" : " style=dashed", block->loop == b ? " penwidth=2" : "");
+        for(int k = 0; k < 2; ++k) {
+            if(block->succ[k] != HXR_CFG_NONE) printf("    b%zu -> b%zu\n", b, block->succ[k]);
+        }
+    }
+    printf("}\n");
+}
+
+void print_stats(const HXR_Cfg* cfg)
+{
+    size_t reachable_blocks = 0, reachable_insts = 0;
+    uint64_t mix[32] = {0}, reachable_mix[32] = {0};
+    for(size_t b = 0; b < cfg->block_count; ++b) {
+        const HXR_Block* block = &cfg->blocks[b];
+        size_t first = (block->start - HXR_INSTRUCTIONS_START) / 2;
+        for(size_t i = first; i < first + block->count; ++i) {
+            mix[hxr_opcode(cfg->code[i])] += 1;
+            if(block->reachable) reachable_mix[hxr_opcode(cfg->code[i])] += 1;
+        }
+        if(block->reachable) {
+            reachable_blocks += 1;
+            reachable_insts += block->count;
+        }
+    }
+
+    printf("Instructions: %zu (%zu reachable)\n", cfg->count, reachable_insts);
+    printf("Blocks: %zu (%zu reachable)\n", cfg->block_count, reachable_blocks);
+
+    if(reachable_blocks < cfg->block_count) {
+        printf("Unreachable code:\n");
+        for(size_t b = 0; b < cfg->block_count; ++b) {
+            const HXR_Block* block = &cfg->blocks[b];
+            if(block->reachable) continue;
+            // merge neighbouring unreachable blocks into one range
+            size_t end = b;
+            size_t count = 0;
+            while(end < cfg->block_count && !cfg->blocks[end].reachable) count += cfg->blocks[end++].count;
+            printf("    %u..%zu, %zu instructions\n", block->start, block->start + count * 2 - 2, count);
+            b = end - 1;
+        }
+    }
+
+    printf("Loops: %zu", cfg->loop_count);
+    if(cfg->irreducible > 0) printf(", %zu irreducible edges", cfg->irreducible);
+    printf("\n");
+    for(size_t i = 0; i < cfg->loop_count; ++i) {
+        HXR_Loop loop = cfg->loops[i];
+        printf("    header %u, %zu blocks, %zu instructions, back edges from",
+                cfg->blocks[loop.header].start, loop.blocks, loop.instructions);
+        for(size_t k = cfg->pred_index[loop.header]; k < cfg->pred_index[loop.header + 1]; ++k) {
+            size_t p = cfg->preds[k];
+            if(!cfg->blocks[p].reachable || cfg->blocks[p].rpo < cfg->blocks[loop.header].rpo) continue;
+            if(hxr_cfg_dominates(cfg, loop.header, p)) printf(" %u", cfg->blocks[p].start);
+        }
+        printf("\n");
+    }
+
+    // Static path lengths from the entry to every HALT over the graph without
+    // its retreating edges, so every loop counts as one iteration.
+    uint64_t* shortest = (uint64_t*)malloc(cfg->block_count * sizeof(uint64_t));
+    uint64_t* longest = (uint64_t*)calloc(cfg->block_count, sizeof(uint64_t));
+    uint64_t* cycles = (uint64_t*)calloc(cfg->block_count, sizeof(uint64_t));
+    for(size_t b = 0; b < cfg->block_count; ++b) {
+        shortest[b] = UINT64_MAX;
+        size_t first = (cfg->blocks[b].start - HXR_INSTRUCTIONS_START) / 2;
+        for(size_t i = first; i < first + cfg->blocks[b].count; ++i) {
+            cycles[b] += hxr_default_cycle_costs[hxr_opcode(cfg->code[i])];
+        }
+    }
+    uint64_t* longest_cycles = (uint64_t*)calloc(cfg->block_count, sizeof(uint64_t));
+    if(cfg->order_count > 0) {
+        shortest[0] = longest[0] = cfg->blocks[0].count;
+        longest_cycles[0] = cycles[0];
+    }
+    for(size_t i = 0; i < cfg->order_count; ++i) {
+        size_t b = cfg->order[i];
+        for(int k = 0; k < 2; ++k) {
+            size_t s = cfg->blocks[b].succ[k];
+            if(s == HXR_CFG_NONE || cfg->blocks[s].rpo <= cfg->blocks[b].rpo) continue;
+            uint64_t length = cfg->blocks[s].count;
+            if(shortest[b] + length < shortest[s]) shortest[s] = shortest[b] + length;
+            if(longest[b] + length > longest[s]) longest[s] = longest[b] + length;
+            if(longest_cycles[b] + cycles[s] > longest_cycles[s]) longest_cycles[s] = longest_cycles[b] + cycles[s];
+        }
+    }
+    uint64_t min_path = UINT64_MAX, max_path = 0, max_cycles = 0;
+    for(size_t b = 0; b < cfg->block_count; ++b) {
+        if(!cfg->blocks[b].reachable || !cfg->blocks[b].halts) continue;
+        if(shortest[b] < min_path) min_path = shortest[b];
+        if(longest[b] > max_path) max_path = longest[b];
+        if(longest_cycles[b] > max_cycles) max_cycles = longest_cycles[b];
+    }
+    if(min_path == UINT64_MAX) {
+        printf("Paths: no reachable HLT\n");
+    } else {
+        printf("Paths to HLT, loops taken once: shortest %llu instructions, longest %llu instructions (%llu cycles)\n",
+                (unsigned long long)min_path, (unsigned long long)max_path, (unsigned long long)max_cycles);
+    }
+    free(shortest);
+    free(longest);
+    free(longest_cycles);
+    free(cycles);
+
+    printf("Instruction mix (all / reachable):\n");
+    for(int op = 0; op < 32; ++op) {
+        if(mix[op] == 0) continue;
+        printf("    %-5s %6llu %5.1f%%  %6llu %5.1f%%\n", hxr_opcode_name(op),
+                (unsigned long long)mix[op], 100.0 * mix[op] / cfg->count,
+                (unsigned long long)reachable_mix[op], reachable_insts ? 100.0 * reachable_mix[op] / reachable_insts : 0.0);
+    }
+}
+
+int main(int argc, const char** argv)
+{
+    bool stats_only = false, dot = false;
+    const char* rom = NULL;
+    for(int i = 1; i < argc; ++i) {
+        if(strcmp(argv[i], "-s") == 0) stats_only = true;
+        else if(strcmp(argv[i], "--dot") == 0) dot = true;
+        else rom = argv[i];
+    }
+    if(rom == NULL) {
+        fprintf(stderr, "ERROR: Please provide an argument\n");
+        usage(stderr, argv[0]);
+        return 1;
+    }
+
+    size_t count = 0;
+    uint16_t* code = load_image(rom, &count);
+    if(!code) {
+        fprintf(stderr, "ERROR: Failed to load ROM\n");
+        return 1;
+    }
+    HXR_Cfg cfg;
+    if(hxr_cfg_build(&cfg, code, count) != 0) {
+        fprintf(stderr, "ERROR: ROM does not fit in the address space\n");
+        free(code);
+        return 1;
+    }
+
+    if(dot) {
+        print_dot(&cfg);
+    } else if(stats_only) {
+        print_stats(&cfg);
+    } else {
+        print_listing(&cfg);
+    }
+
+    hxr_cfg_free(&cfg);
+    free(code);
+    return 0;
+}
@@ -1,32 +1,844 @@
+#define _POSIX_C_SOURCE 200809L
 #include "hxr.h"
+#include "hxr_sched.h"
+#include "hxr_stats.h"
+#define COMMON_IMPLEMENTATION
+#include "common.h"
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 void usage(FILE* f, const char* name)
 {
-    fprintf(f, "USAGE: %s [rom]\n", name);
+    fprintf(f, "USAGE: %s [--stats] [--profile rom.lines] [--cost OPCODE=CYCLES] [-c cores] [rom]\n", name);
+    fprintf(f, "       %s [--stats] [-g copies] [-s slice] [-p high|normal|low] [rom]...\n", name);
+    fprintf(f, "       %s --serve [socket]\n", name);
+    fprintf(f, "       %s --debug [rom]\n", name);
 }
 
-int main(int argc, const char** argv)
+typedef struct {
+    HXR* hxr;
+    HXR_Status status;
+} Core;
+
+void* run_core(void* arg)
 {
-    if(argc < 2) {
-        fprintf(stderr, "ERROR: Please provide an argument\n");
-        usage(stderr, argv[0]);
+    Core* core = (Core*)arg;
+    core->status = hxr_run(core->hxr, 0);
+    return NULL;
+}
+
+// Server mode keeps one instance and every ROM it has seen warm. Jobs are
+// lines of `key=value` pairs:
+//     rom=<path> | image=<hex>, budget=<steps>, r0=<value> .. r7=<value>
+// and each one is answered with a single line:
+//     ok status=<status> steps=<n> cycles=<n> ns=<job time> r0=<value> .. r7=<value>
+//     error <message>
+// A job runs at most SERVE_BUDGET steps, so a guest that never halts cannot
+// take the server down with it.
+#define SERVE_BUDGET 10000000
+
+typedef struct {
+    char* path;
+    uint8_t* data;
+    size_t size;
+} Rom;
+
+typedef da(uint8_t) Image;
+
+typedef struct {
+    HXR* hxr;
+    da(Rom) roms;
+    Image image;
+    size_t loaded; // end of the last image in memory, it can reach past frame 3
+} Server;
+
+bool key_is(String_View key, const char* name)
+{
+    return key.count == strlen(name) && sv_eq(key, sv_from_cstr(name));
+}
+
+Rom* server_rom(Server* server, String_View path)
+{
+    for(size_t i = 0; i < server->roms.count; ++i) {
+        if(key_is(path, server->roms.data[i].path)) return &server->roms.data[i];
+    }
+
+    Rom rom = {0};
+    rom.path = strndup(path.data, path.count);
+    FILE* f = fopen(rom.path, "rb");
+    if(!f) {
+        free(rom.path);
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    rom.size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    rom.data = (uint8_t*)malloc(rom.size);
+    if(!rom.data || fread(rom.data, 1, rom.size, f) != rom.size) {
+        fclose(f);
+        free(rom.data);
+        free(rom.path);
+        return NULL;
+    }
+    fclose(f);
+    da_append(&server->roms, rom);
+    return &server->roms.data[server->roms.count - 1];
+}
+
+int hex_digit(char c)
+{
+    if('0' <= c && c <= '9') return c - '0';
+    if('a' <= c && c <= 'f') return c - 'a' + 10;
+    if('A' <= c && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+bool parse_hex(String_View hex, Image* image)
+{
+    image->count = 0;
+    if(hex.count % 2 != 0) return false;
+    for(size_t i = 0; i < hex.count; i += 2) {
+        int hi = hex_digit(hex.data[i]);
+        int lo = hex_digit(hex.data[i + 1]);
+        if(hi < 0 || lo < 0) return false;
+        da_append(image, (uint8_t)(hi << 4 | lo));
+    }
+    return true;
+}
+
+uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void serve_job(Server* server, String_View line, FILE* out)
+{
+    uint64_t start = now_ns();
+    HXR* hxr = server->hxr;
+    const uint8_t* image = NULL;
+    size_t image_size = 0;
+    uint64_t budget = SERVE_BUDGET;
+    uint16_t r[8] = {0};
+
+    while(line.count > 0) {
+        String_View value = sv_chop_by_delim(&line, ' ');
+        String_View key = sv_chop_by_delim(&value, '=');
+        if(key.count == 0) continue;
+        if(key_is(key, "rom")) {
+            Rom* rom = server_rom(server, value);
+            if(!rom) {
+                fprintf(out, "error failed to load rom "SV_FMT"\n", SV_ARGV(value));
+                return;
+            }
+            image = rom->data;
+            image_size = rom->size;
+        } else if(key_is(key, "image")) {
+            if(!parse_hex(value, &server->image)) {
+                fprintf(out, "error invalid image\n");
+                return;
+            }
+            image = server->image.data;
+            image_size = server->image.count;
+        } else if(key_is(key, "budget")) {
+            budget = (uint64_t)sv_to_int(value);
+            if(budget == 0 || budget > SERVE_BUDGET) budget = SERVE_BUDGET;
+        } else if(key.count == 2 && key.data[0] == 'r' && '0' <= key.data[1] && key.data[1] <= '7') {
+            r[key.data[1] - '0'] = (uint16_t)sv_to_int(value);
+        } else {
+            fprintf(out, "error unknown key "SV_FMT"\n", SV_ARGV(key));
+            return;
+        }
+    }
+    if(!image) {
+        fprintf(out, "error no rom or image\n");
+        return;
+    }
+
+    // the last job could only dirty the frames it mapped and its image
+    size_t dirty = (size_t)(hxr->max_frame + 1) * HXR_BANK_SIZE;
+    if(server->loaded > dirty) dirty = server->loaded;
+    memset(hxr->mem, 0, dirty);
+    server->loaded = 0;
+    if(hxr_load_image(hxr->mem, image, image_size) != 0) {
+        fprintf(out, "error image too large\n");
+        return;
+    }
+    server->loaded = HXR_INSTRUCTIONS_START + image_size;
+    hxr_reset(hxr, hxr->mem, 0);
+    memcpy(hxr->r, r, sizeof(r));
+    HXR_Status status = hxr_run(hxr, budget);
+    uint64_t elapsed = now_ns() - start;
+
+    fprintf(out, "ok status=%s steps=%llu cycles=%llu ns=%llu", hxr_status_name(status),
+            (unsigned long long)hxr->retired, (unsigned long long)hxr->cycles, (unsigned long long)elapsed);
+    for(int i = 0; i < 8; ++i) {
+        fprintf(out, " r%d=%u", i, hxr->r[i]);
+    }
+    fprintf(out, "\n");
+}
+
+void serve_stream(Server* server, FILE* in, FILE* out)
+{
+    char* buf = NULL;
+    size_t cap = 0;
+    ssize_t n;
+    while((n = getline(&buf, &cap, in)) > 0) {
+        String_View line = sv_from_parts(buf, n);
+        while(line.count > 0 && __common_iswhitespace(line.data[line.count - 1])) line.count -= 1;
+        if(line.count == 0) continue;
+        serve_job(server, line, out);
+        // a client that went away only ends its own connection
+        if(fflush(out) != 0 || ferror(out)) break;
+    }
+    free(buf);
+}
+
+int serve(const char* socket_path)
+{
+    Server server = {0};
+    server.hxr = hxr_create(NULL);
+    if(!server.hxr) {
+        fprintf(stderr, "ERROR: Failed to create instance\n");
+        return 1;
+    }
+
+    // write errors are handled per connection instead of killing the server
+    signal(SIGPIPE, SIG_IGN);
+    if(socket_path == NULL) {
+        serve_stream(&server, stdin, stdout);
+    } else {
+        struct sockaddr_un addr = {0};
+        addr.sun_family = AF_UNIX;
+        if(strlen(socket_path) >= sizeof(addr.sun_path)) {
+            fprintf(stderr, "ERROR: Socket path is too long\n");
+            return 1;
+        }
+        strcpy(addr.sun_path, socket_path);
+        unlink(socket_path);
+
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if(fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 8) != 0) {
+            fprintf(stderr, "ERROR: Failed to listen on %s\n", socket_path);
+            return 1;
+        }
+        for(;;) {
+            int client = accept(fd, NULL, NULL);
+            if(client < 0) continue;
+            FILE* in = fdopen(client, "r");
+            FILE* out = fdopen(dup(client), "w");
+            if(in && out) serve_stream(&server, in, out);
+            if(in) fclose(in);
+            if(out) fclose(out);
+        }
+    }
+
+    for(size_t i = 0; i < server.roms.count; ++i) {
+        free(server.roms.data[i].path);
+        free(server.roms.data[i].data);
+    }
+    da_free(&server.roms);
+    da_free(&server.image);
+    hxr_destroy(server.hxr);
+    return 0;
+}
+
+// Line table written by `hxr-asm -g`, used to fold a per instruction profile
+// into source lines and labels.
+typedef struct {
+    uint16_t addr;
+    int line;
+} Line_Entry;
+
+typedef struct {
+    char name[64];
+    uint16_t addr;
+    uint64_t count;
+} Label_Entry;
+
+typedef struct {
+    char file[4096];
+    da(Line_Entry) lines;
+    da(Label_Entry) labels;
+} Line_Table;
+
+bool load_line_table(const char* path, Line_Table* table)
+{
+    FILE* f = fopen(path, "r");
+    if(!f) return false;
+    char buf[4096 + 16];
+    while(fgets(buf, sizeof(buf), f)) {
+        unsigned addr;
+        int line;
+        Label_Entry label = {0};
+        if(sscanf(buf, "file %4095[^\n]", table->file) == 1) continue;
+        if(sscanf(buf, "label %63s %u", label.name, &addr) == 2) {
+            label.addr = (uint16_t)addr;
+            da_append(&table->labels, label);
+        } else if(sscanf(buf, "%u %d", &addr, &line) == 2) {
+            Line_Entry entry = { (uint16_t)addr, line };
+            da_append(&table->lines, entry);
+        }
+    }
+    fclose(f);
+    return true;
+}
+
+int compare_counts_desc(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return x > y ? -1 : x < y;
+}
+
+int compare_labels_desc(const void* a, const void* b)
+{
+    return compare_counts_desc(&((const Label_Entry*)a)->count, &((const Label_Entry*)b)->count);
+}
+
+void report_profile(Line_Table* table, const uint64_t* counts)
+{
+    // per source line, with the text of the line when the source is around
+    typedef struct { uint64_t count; int line; } Line_Count;
+    int max_line = 0;
+    for(size_t i = 0; i < table->lines.count; ++i) {
+        if(table->lines.data[i].line > max_line) max_line = table->lines.data[i].line;
+    }
+    uint64_t* per_line = (uint64_t*)calloc(max_line + 1, sizeof(uint64_t));
+    if(!per_line) return;
+
+    uint64_t total = 0;
+    size_t label = 0;
+    for(size_t i = 0; i < table->lines.count; ++i) {
+        Line_Entry entry = table->lines.data[i];
+        uint64_t count = counts[entry.addr >> 1];
+        total += count;
+        if(entry.line >= 0) per_line[entry.line] += count;
+
+        // labels come sorted by address, an instruction belongs to the last
+        // one at or before it
+        while(label + 1 < table->labels.count && table->labels.data[label + 1].addr <= entry.addr) label += 1;
+        if(label < table->labels.count && table->labels.data[label].addr <= entry.addr) {
+            table->labels.data[label].count += count;
+        }
+    }
+
+    da(Line_Count) lines = {0};
+    for(int line = 0; line <= max_line; ++line) {
+        if(per_line[line] == 0) continue;
+        Line_Count line_count = { per_line[line], line };
+        da_append(&lines, line_count);
+    }
+    free(per_line);
+    if(total == 0) {
+        da_free(&lines);
+        return;
+    }
+    qsort(lines.data, lines.count, sizeof(Line_Count), compare_counts_desc);
+    qsort(table->labels.data, table->labels.count, sizeof(Label_Entry), compare_labels_desc);
+
+    da(String_View) source = {0};
+    FILE* f = fopen(table->file, "rb");
+    char* text = NULL;
+    if(f) {
+        fseek(f, 0, SEEK_END);
+        long size = ftell(f);
+        fseek(f, 0, SEEK_SET);
+        text = (char*)malloc(size > 0 ? size : 1);
+        if(text && size > 0 && fread(text, 1, size, f) == (size_t)size) {
+            String_View rest = sv_from_parts(text, size);
+            while(rest.count > 0) da_append(&source, sv_chop_by_delim(&rest, '\n'));
+        }
+        fclose(f);
+    }
+
+    printf("Profile (%llu instructions):\n", (unsigned long long)total);
+    for(size_t i = 0; i < lines.count && i < 20; ++i) {
+        Line_Count line = lines.data[i];
+        String_View code = line.line >= 1 && (size_t)line.line <= source.count ? source.data[line.line - 1] : INVALID_SV;
+        sv_chop_left_while(&code, __common_iswhitespace);
+        printf("%12llu %5.1f%%  %s:%d  "SV_FMT"\n", (unsigned long long)line.count,
+                100.0 * line.count / total, table->file, line.line, SV_ARGV(code));
+    }
+    printf("Labels:\n");
+    for(size_t i = 0; i < table->labels.count && table->labels.data[i].count > 0; ++i) {
+        Label_Entry label = table->labels.data[i];
+        printf("%12llu %5.1f%%  %s\n", (unsigned long long)label.count, 100.0 * label.count / total, label.name);
+    }
+
+    da_free(&lines);
+    da_free(&source);
+    free(text);
+}
+
+int run_cores(const char* rom, int cores, const uint8_t* costs, HXR_Stats_Region* stats, Line_Table* lines)
+{
+    if(cores < 1 || cores > HXR_MAX_CORES) {
+        fprintf(stderr, "ERROR: Core count must be between 1 and %d\n", HXR_MAX_CORES);
         return 1;
     }
 
-    HXR hxr = {0};
-    if(hxr_init(&hxr, argv[1]) != 0) {
+    Core core[HXR_MAX_CORES] = {0};
+    pthread_t threads[HXR_MAX_CORES];
+    for(int i = 0; i < cores; ++i) {
+        core[i].hxr = hxr_create(i == 0 ? NULL : core[0].hxr->mem);
+        if(!core[i].hxr) {
+            fprintf(stderr, "ERROR: Failed to create core %d\n", i);
+            return 1;
+        }
+        core[i].hxr->id = i;
+        core[i].hxr->costs = costs;
+        if(stats) core[i].hxr->stats = &stats->core[i];
+        if(lines) {
+            core[i].hxr->profile = (uint64_t*)calloc(HXR_ADDRESS_SPACE / 2, sizeof(uint64_t));
+            if(!core[i].hxr->profile) {
+                fprintf(stderr, "ERROR: Failed to allocate the profile\n");
+                return 1;
+            }
+        }
+    }
+    if(hxr_load_rom(core[0].hxr->mem, rom) != 0) {
+        fprintf(stderr, "ERROR: Failed to load ROM\n");
+        return 1;
+    }
+
+    if(cores == 1) {
+        run_core(&core[0]);
+    } else {
+        for(int i = 0; i < cores; ++i) {
+            if(pthread_create(&threads[i], NULL, run_core, &core[i]) != 0) {
+                fprintf(stderr, "ERROR: Failed to start core %d\n", i);
+                return 1;
+            }
+        }
+        for(int i = 0; i < cores; ++i) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+
+    int result = 0;
+    for(int i = 0; i < cores; ++i) {
+        if(cores > 1) printf("Core %d:\n", i);
+        if(core[i].status != HXR_HALTED) {
+            fprintf(stderr, "ERROR: %s at ip %u\n", hxr_status_name(core[i].status), core[i].hxr->ip);
+            result = 1;
+        }
+        hxr_dump_registers(core[i].hxr);
+        printf("Cycles: %llu, %llu instructions\n", (unsigned long long)core[i].hxr->cycles,
+                (unsigned long long)core[i].hxr->retired);
+    }
+
+    HXR_Heap_Stats heap = {0};
+    for(int i = 0; i < cores; ++i) {
+        heap.allocs += core[i].hxr->heap.allocs;
+        heap.frees += core[i].hxr->heap.frees;
+        heap.failures += core[i].hxr->heap.failures;
+        heap.allocated += core[i].hxr->heap.allocated;
+        heap.freed += core[i].hxr->heap.freed;
+    }
+    if(heap.allocs > 0 || heap.failures > 0) {
+        printf("Heap: %llu allocs, %llu frees, %llu failed, %llu bytes in use\n",
+                (unsigned long long)heap.allocs, (unsigned long long)heap.frees,
+                (unsigned long long)heap.failures, (unsigned long long)(heap.allocated - heap.freed));
+    }
+
+    if(lines) {
+        for(int i = 1; i < cores; ++i) {
+            for(size_t j = 0; j < HXR_ADDRESS_SPACE / 2; ++j) {
+                core[0].hxr->profile[j] += core[i].hxr->profile[j];
+            }
+        }
+        report_profile(lines, core[0].hxr->profile);
+    }
+
+    // core 0 owns the shared memory, so it goes last
+    for(int i = cores - 1; i >= 0; --i) {
+        free(core[i].hxr->profile);
+        hxr_destroy(core[i].hxr);
+    }
+    return result;
+}
+
+typedef struct {
+    const char* rom;
+    HXR_Priority priority;
+} Guest;
+
+// runs `copies` instances of every guest time sliced on this thread
+int run_guests(Guest* guests, size_t count, int copies, uint64_t slice, const uint8_t* costs, HXR_Stats_Region* stats)
+{
+    size_t total = count * copies;
+    HXR_Task* tasks = (HXR_Task*)calloc(total, sizeof(HXR_Task));
+    if(!tasks) return 1;
+
+    HXR_Sched sched;
+    hxr_sched_init(&sched, slice);
+    for(size_t i = 0; i < total; ++i) {
+        Guest guest = guests[i % count];
+        HXR* hxr = hxr_create(NULL);
+        if(!hxr || hxr_load_rom(hxr->mem, guest.rom) != 0) {
+            fprintf(stderr, "ERROR: Failed to load ROM %s\n", guest.rom);
+            return 1;
+        }
+        hxr->costs = costs;
+        // all guests run on this thread so they can share one slot
+        if(stats) hxr->stats = &stats->core[0];
+        hxr_sched_add(&sched, &tasks[i], hxr, guest.priority);
+    }
+    hxr_sched_run(&sched);
+
+    static const char* priority_names[HXR_PRIORITY_COUNT] = { "high", "normal", "low" };
+    int result = 0;
+    for(size_t i = 0; i < total; ++i) {
+        HXR_Task* task = &tasks[i];
+        printf("Guest %zu (%s, %s): %s, %llu instructions, %llu cycles, %llu slices, max wait %llu instructions\n",
+                i, guests[i % count].rom, priority_names[task->priority], hxr_status_name(task->status),
+                (unsigned long long)task->hxr->retired, (unsigned long long)task->hxr->cycles,
+                (unsigned long long)task->slices,
+                (unsigned long long)task->max_wait);
+        if(task->status != HXR_HALTED) result = 1;
+        hxr_destroy(task->hxr);
+    }
+    free(tasks);
+    return result;
+}
+
+// Interactive debugger on a single core. Breakpoints are patched into guest
+// memory as HXR_BREAKPOINT and watchpoints flag their pages, so the guest runs
+// at full speed until one of them is hit.
+typedef struct {
+    uint16_t addr;
+    uint16_t original;
+} Breakpoint;
+
+typedef struct {
+    uint16_t addr;
+    uint16_t size;
+    uint8_t kind; // HXR_PAGE_WATCH_*
+} Watchpoint;
+
+typedef struct {
+    HXR* hxr;
+    uint8_t pages[HXR_PAGE_COUNT];
+    da(Breakpoint) breakpoints;
+    da(Watchpoint) watchpoints;
+} Debugger;
+
+uint16_t peek_16(HXR* hxr, uint16_t addr)
+{
+    return *hxr_translate(hxr, addr) | *hxr_translate(hxr, addr + 1) << 8;
+}
+
+void poke_16(HXR* hxr, uint16_t addr, uint16_t value)
+{
+    *hxr_translate(hxr, addr) = value & 0xff;
+    *hxr_translate(hxr, addr + 1) = value >> 8;
+}
+
+Breakpoint* find_breakpoint(Debugger* dbg, uint16_t addr)
+{
+    for(size_t i = 0; i < dbg->breakpoints.count; ++i) {
+        if(dbg->breakpoints.data[i].addr == addr) return &dbg->breakpoints.data[i];
+    }
+    return NULL;
+}
+
+// memory as the guest sees it, without the patched breakpoint words
+uint8_t peek_original(Debugger* dbg, uint16_t addr)
+{
+    Breakpoint* bp = find_breakpoint(dbg, addr & ~1);
+    if(bp) return addr & 1 ? bp->original >> 8 : bp->original & 0xff;
+    return *hxr_translate(dbg->hxr, addr);
+}
+
+// Watchpoints are set through the current bank mapping. Page flags are only
+// attached while there is a watchpoint, since they send `hxr_run` down its
+// instrumented loop.
+void refresh_watch_pages(Debugger* dbg)
+{
+    for(size_t page = 0; page < HXR_PAGE_COUNT; ++page) {
+        dbg->pages[page] &= ~(HXR_PAGE_WATCH_READ | HXR_PAGE_WATCH_WRITE);
+    }
+    for(size_t i = 0; i < dbg->watchpoints.count; ++i) {
+        Watchpoint w = dbg->watchpoints.data[i];
+        uint32_t last = ((uint32_t)w.addr + w.size - 1) >> HXR_PAGE_SHIFT;
+        for(uint32_t guest = w.addr >> HXR_PAGE_SHIFT; guest <= last && guest < HXR_ADDRESS_SPACE >> HXR_PAGE_SHIFT; ++guest) {
+            uint8_t* host = hxr_translate(dbg->hxr, guest << HXR_PAGE_SHIFT);
+            dbg->pages[(host - dbg->hxr->mem) >> HXR_PAGE_SHIFT] |= w.kind;
+        }
+    }
+    dbg->hxr->pages = dbg->watchpoints.count > 0 ? dbg->pages : NULL;
+}
+
+void print_location(HXR* hxr, uint16_t inst)
+{
+    printf("ip %u: %04x %s ra=r%u rb=r%u imm=%u\n", hxr->ip, inst, hxr_opcode_name(hxr_opcode(inst)),
+            hxr_ra(inst), hxr_rb(inst), hxr_imm_8(inst));
+}
+
+// Runs up to `budget` instructions (0 for no limit) and reports why it stopped.
+// Leaving a breakpoint executes its original instruction first.
+HXR_Status debug_run(Debugger* dbg, uint64_t budget)
+{
+    HXR* hxr = dbg->hxr;
+    uint64_t left = budget;
+    for(;;) {
+        uint64_t retired = hxr->retired;
+        HXR_Status status;
+        Breakpoint* bp = find_breakpoint(dbg, hxr->ip);
+        if(bp) {
+            poke_16(hxr, bp->addr, bp->original);
+            status = hxr_run(hxr, 1);
+            poke_16(hxr, bp->addr, HXR_BREAKPOINT);
+        } else {
+            status = hxr_run(hxr, left);
+        }
+        if(budget > 0) left -= hxr->retired - retired;
+
+        if(status == HXR_BREAK && hxr->watch_hit) {
+            // the page is watched, but maybe not these bytes
+            uint8_t kind = hxr->watch_hit;
+            hxr->watch_hit = 0;
+            for(size_t i = 0; i < dbg->watchpoints.count; ++i) {
+                Watchpoint w = dbg->watchpoints.data[i];
+                if((w.kind & kind) && hxr->watch_addr < w.addr + w.size && w.addr < hxr->watch_addr + hxr->watch_size) {
+                    printf("Watchpoint %u: %s of %u bytes at %u\n", w.addr,
+                            kind & HXR_PAGE_WATCH_WRITE ? "write" : "read", hxr->watch_size, hxr->watch_addr);
+                    return status;
+                }
+            }
+            status = HXR_RUNNING;
+        } else if(status == HXR_BREAK && find_breakpoint(dbg, hxr->ip)) {
+            printf("Breakpoint at %u\n", hxr->ip);
+            return status;
+        } else if(status == HXR_BREAK) {
+            // a `brk` in the ROM itself, stop on it once and move past it
+            printf("brk at %u\n", hxr->ip);
+            hxr->ip += 2;
+            return status;
+        }
+
+        if(status != HXR_RUNNING) {
+            printf("Stopped: %s at ip %u\n", hxr_status_name(status), hxr->ip);
+            return status;
+        }
+        if(budget > 0 && left == 0) return status;
+    }
+}
+
+bool parse_number(const char* text, unsigned long* value)
+{
+    char* end;
+    if(!text) return false;
+    *value = strtoul(text, &end, 0);
+    return end != text;
+}
+
+int debug(const char* rom)
+{
+    static Debugger dbg = {0};
+    dbg.hxr = hxr_create(NULL);
+    if(!dbg.hxr || hxr_load_rom(dbg.hxr->mem, rom) != 0) {
         fprintf(stderr, "ERROR: Failed to load ROM\n");
         return 1;
     }
+    HXR* hxr = dbg.hxr;
+
+    printf("Type `h` for help\n");
+    print_location(hxr, hxr_fetch(hxr));
+    char line[256];
+    for(;;) {
+        printf("(hxr) ");
+        fflush(stdout);
+        if(!fgets(line, sizeof(line), stdin)) break;
+
+        char* cmd = strtok(line, " \t\r\n");
+        char* arg1 = strtok(NULL, " \t\r\n");
+        char* arg2 = strtok(NULL, " \t\r\n");
+        unsigned long a, b;
+        if(!cmd) continue;
 
-    while(hxr.halt == 0) {
-        uint16_t inst = hxr_fetch(&hxr);
-        hxr_execute(&hxr, inst);
-        hxr.ip += 2;
+        if(strcmp(cmd, "h") == 0) {
+            printf("b <addr>             set a breakpoint\n");
+            printf("d <addr>             delete the breakpoint or watchpoint at addr\n");
+            printf("w <addr> [size] [r|w|rw]  watch memory, writes by default\n");
+            printf("s [n]                step n instructions\n");
+            printf("c                    continue\n");
+            printf("r                    show registers\n");
+            printf("x <addr> [n]         show n bytes of memory\n");
+            printf("l                    list breakpoints and watchpoints\n");
+            printf("q                    quit\n");
+        } else if(strcmp(cmd, "b") == 0 && parse_number(arg1, &a)) {
+            uint16_t addr = (uint16_t)a & ~1;
+            if(find_breakpoint(&dbg, addr)) continue;
+            Breakpoint bp = { addr, peek_16(hxr, addr) };
+            da_append(&dbg.breakpoints, bp);
+            poke_16(hxr, addr, HXR_BREAKPOINT);
+        } else if(strcmp(cmd, "d") == 0 && parse_number(arg1, &a)) {
+            Breakpoint* bp = find_breakpoint(&dbg, (uint16_t)a & ~1);
+            if(bp) {
+                poke_16(hxr, bp->addr, bp->original);
+                *bp = dbg.breakpoints.data[--dbg.breakpoints.count];
+            }
+            for(size_t i = 0; i < dbg.watchpoints.count; ++i) {
+                if(dbg.watchpoints.data[i].addr == (uint16_t)a) {
+                    dbg.watchpoints.data[i--] = dbg.watchpoints.data[--dbg.watchpoints.count];
+                }
+            }
+            refresh_watch_pages(&dbg);
+        } else if(strcmp(cmd, "w") == 0 && parse_number(arg1, &a)) {
+            const char* kind = arg2;
+            b = 1;
+            if(parse_number(arg2, &b)) kind = strtok(NULL, " \t\r\n");
+            Watchpoint w = { (uint16_t)a, (uint16_t)(b > 0 ? b : 1), HXR_PAGE_WATCH_WRITE };
+            if(kind && strcmp(kind, "r") == 0) w.kind = HXR_PAGE_WATCH_READ;
+            if(kind && strcmp(kind, "rw") == 0) w.kind = HXR_PAGE_WATCH_READ | HXR_PAGE_WATCH_WRITE;
+            da_append(&dbg.watchpoints, w);
+            refresh_watch_pages(&dbg);
+        } else if(strcmp(cmd, "s") == 0) {
+            if(!parse_number(arg1, &a) || a == 0) a = 1;
+            debug_run(&dbg, a);
+            Breakpoint* bp = find_breakpoint(&dbg, hxr->ip);
+            print_location(hxr, bp ? bp->original : peek_16(hxr, hxr->ip));
+        } else if(strcmp(cmd, "c") == 0) {
+            debug_run(&dbg, 0);
+            Breakpoint* bp = find_breakpoint(&dbg, hxr->ip);
+            print_location(hxr, bp ? bp->original : peek_16(hxr, hxr->ip));
+        } else if(strcmp(cmd, "r") == 0) {
+            hxr_dump_registers(hxr);
+            printf("IP(%u)\nSP(%u)\n", hxr->ip, hxr->sp);
+        } else if(strcmp(cmd, "x") == 0 && parse_number(arg1, &a)) {
+            if(!parse_number(arg2, &b) || b == 0) b = 16;
+            for(unsigned long i = 0; i < b; ++i) {
+                if(i % 16 == 0) printf("%s%5lu:", i ? "\n" : "", (a + i) & 0xffff);
+                printf(" %02x", peek_original(&dbg, (a + i) & 0xffff));
+            }
+            printf("\n");
+        } else if(strcmp(cmd, "l") == 0) {
+            for(size_t i = 0; i < dbg.breakpoints.count; ++i) {
+                printf("breakpoint %u\n", dbg.breakpoints.data[i].addr);
+            }
+            for(size_t i = 0; i < dbg.watchpoints.count; ++i) {
+                Watchpoint w = dbg.watchpoints.data[i];
+                printf("watchpoint %u, %u bytes, %s%s\n", w.addr, w.size,
+                        w.kind & HXR_PAGE_WATCH_READ ? "r" : "", w.kind & HXR_PAGE_WATCH_WRITE ? "w" : "");
+            }
+        } else if(strcmp(cmd, "q") == 0) {
+            break;
+        } else {
+            printf("Unknown command, type `h` for help\n");
+        }
     }
 
-    hxr_dump_registers(&hxr);
+    da_free(&dbg.breakpoints);
+    da_free(&dbg.watchpoints);
+    hxr_destroy(hxr);
     return 0;
 }
+
+int main(int argc, const char** argv)
+{
+    if(argc >= 2 && strcmp(argv[1], "--serve") == 0) {
+        return serve(argc >= 3 ? argv[2] : NULL);
+    }
+    if(argc >= 3 && strcmp(argv[1], "--debug") == 0) {
+        return debug(argv[2]);
+    }
+
+    da(Guest) guests = {0};
+    HXR_Priority priority = HXR_PRIORITY_NORMAL;
+    bool stats = false;
+    const char* profile = NULL;
+    uint8_t costs[32];
+    memcpy(costs, hxr_default_cycle_costs, sizeof(costs));
+    int cores = 1;
+    int copies = 0;
+    uint64_t slice = 1000;
+    for(int i = 1; i < argc; ++i) {
+        if(strcmp(argv[i], "--stats") == 0) {
+            stats = true;
+        } else if(strcmp(argv[i], "--cost") == 0 && i + 1 < argc) {
+            // --cost MNEMONIC=CYCLES, using the names of `hxr_opcode_name`
+            const char* spec = argv[++i];
+            const char* eq = strchr(spec, '=');
+            int op = 0;
+            while(eq && op < 32 && !(strncmp(spec, hxr_opcode_name(op), eq - spec) == 0
+                        && hxr_opcode_name(op)[eq - spec] == '\0')) ++op;
+            if(!eq || op == 32) {
+                fprintf(stderr, "ERROR: Expected --cost OPCODE=CYCLES, got %s\n", spec);
+                return 1;
+            }
+            char* end;
+            long cycles = strtol(eq + 1, &end, 10);
+            if(end == eq + 1 || *end != '\0' || cycles < 0 || cycles > 255) {
+                fprintf(stderr, "ERROR: Cycles of %s must be between 0 and 255, got %s\n", hxr_opcode_name(op), eq + 1);
+                return 1;
+            }
+            costs[op] = (uint8_t)cycles;
+        } else if(strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+            profile = argv[++i];
+        } else if(strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            cores = atoi(argv[++i]);
+        } else if(strcmp(argv[i], "-g") == 0 && i + 1 < argc) {
+            copies = atoi(argv[++i]);
+        } else if(strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            slice = strtoull(argv[++i], NULL, 10);
+        } else if(strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            const char* name = argv[++i];
+            if(strcmp(name, "high") == 0) priority = HXR_PRIORITY_HIGH;
+            else if(strcmp(name, "normal") == 0) priority = HXR_PRIORITY_NORMAL;
+            else if(strcmp(name, "low") == 0) priority = HXR_PRIORITY_LOW;
+            else {
+                fprintf(stderr, "ERROR: Unknown priority %s\n", name);
+                return 1;
+            }
+        } else {
+            Guest guest = { argv[i], priority };
+            da_append(&guests, guest);
+        }
+    }
+
+    if(guests.count == 0) {
+        fprintf(stderr, "ERROR: Please provide an argument\n");
+        usage(stderr, argv[0]);
+        return 1;
+    }
+
+    bool sched = copies > 0 || guests.count > 1;
+    HXR_Stats_Region* region = NULL;
+    if(stats) {
+        region = hxr_stats_create(getpid(), sched ? 1 : cores);
+        if(!region) {
+            fprintf(stderr, "ERROR: Failed to create the stats region\n");
+            return 1;
+        }
+        fprintf(stderr, "Publishing stats for pid %d\n", getpid());
+    }
+
+    int result;
+    if(sched) {
+        if(slice == 0) slice = 1;
+        result = run_guests(guests.data, guests.count, copies > 0 ? copies : 1, slice, costs, region);
+    } else {
+        Line_Table lines = {0};
+        if(profile && !load_line_table(profile, &lines)) {
+            fprintf(stderr, "ERROR: Failed to load line table %s\n", profile);
+            return 1;
+        }
+        result = run_cores(guests.data[0].rom, cores, costs, region, profile ? &lines : NULL);
+        da_free(&lines.lines);
+        da_free(&lines.labels);
+    }
+    if(region) hxr_stats_destroy(region, getpid());
+    da_free(&guests);
+    return result;
+}
@@ -0,0 +1,264 @@
+#define _POSIX_C_SOURCE 200809L
+#include "hxr.h"
+#define COMMON_IMPLEMENTATION
+#include "common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// In process fuzzer. The ROM is loaded once and snapshotted, then every case
+// writes a mutated input into guest memory, runs with a step budget and only
+// copies back the pages the guest dirtied. Inputs reaching new JE/JN/JL/JG
+// edges join the corpus, the first input faulting with a given status at a
+// given ip is saved as crash-<n>.bin.
+//
+// The guest starts with r1 = input address and r2 = input length.
+
+void usage(FILE* f, const char* name)
+{
+    fprintf(f, "USAGE: %s [-i addr:len] [-b budget] [-n execs] [-s seed] [rom] [seed files]...\n", name);
+}
+
+typedef struct {
+    uint8_t* data;
+} Input;
+
+typedef struct {
+    uint16_t addr;
+    uint16_t len;
+    uint64_t budget;
+    uint64_t rng;
+    da(Input) corpus;
+    uint8_t virgin[HXR_COVERAGE_SIZE];
+    size_t edges;
+    da(uint32_t) faults; // status << 16 | ip of every crash seen
+    size_t crashes;
+    size_t hangs;
+} Fuzzer;
+
+uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+uint64_t rng_next(Fuzzer* fuzzer)
+{
+    // xorshift64
+    uint64_t x = fuzzer->rng;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return fuzzer->rng = x;
+}
+
+uint32_t rng_below(Fuzzer* fuzzer, uint32_t n)
+{
+    return (uint32_t)(rng_next(fuzzer) % n);
+}
+
+void mutate(Fuzzer* fuzzer, uint8_t* data)
+{
+    static const uint8_t interesting[] = { 0x00, 0x01, 0x7f, 0x80, 0xff, 0x10, 0x20, 0x40 };
+    uint32_t rounds = 1 + rng_below(fuzzer, 8);
+    for(uint32_t i = 0; i < rounds; ++i) {
+        uint32_t at = rng_below(fuzzer, fuzzer->len);
+        switch(rng_below(fuzzer, 5)) {
+            case 0: data[at] ^= 1 << rng_below(fuzzer, 8); break;
+            case 1: data[at] = (uint8_t)rng_next(fuzzer); break;
+            case 2: data[at] = interesting[rng_below(fuzzer, sizeof(interesting))]; break;
+            case 3: data[at] += (uint8_t)(rng_below(fuzzer, 35) - 17); break;
+            case 4:
+                {
+                    // splice a chunk from another corpus entry
+                    Input other = fuzzer->corpus.data[rng_below(fuzzer, fuzzer->corpus.count)];
+                    uint32_t from = rng_below(fuzzer, fuzzer->len);
+                    uint32_t size = 1 + rng_below(fuzzer, fuzzer->len - (at > from ? at : from));
+                    memcpy(&data[at], &other.data[from], size);
+                } break;
+        }
+    }
+}
+
+// AFL style hit count buckets, a new bucket on any edge counts as new coverage
+uint8_t bucket(uint8_t hits)
+{
+    if(hits == 0) return 0;
+    if(hits <= 3) return hits == 3 ? 4 : hits;
+    if(hits <= 7) return 8;
+    if(hits <= 15) return 16;
+    if(hits <= 31) return 32;
+    if(hits <= 127) return 64;
+    return 128;
+}
+
+// Walks the map a word at a time, since only a handful of edges are hit per
+// case, and zeroes the words it saw hits in for the next case. Cases that did
+// not halt only get their hits cleared.
+bool has_new_coverage(Fuzzer* fuzzer, uint64_t* words, bool halted)
+{
+    bool found = false;
+    for(size_t w = 0; w < HXR_COVERAGE_SIZE / 8; ++w) {
+        if(words[w] == 0) continue;
+        const uint8_t* coverage = (const uint8_t*)words;
+        for(size_t i = w * 8; halted && i < w * 8 + 8; ++i) {
+            if(coverage[i] == 0) continue;
+            uint8_t b = bucket(coverage[i]);
+            if(b & ~fuzzer->virgin[i]) {
+                if(fuzzer->virgin[i] == 0) fuzzer->edges += 1;
+                fuzzer->virgin[i] |= b;
+                found = true;
+            }
+        }
+        words[w] = 0;
+    }
+    return found;
+}
+
+void add_input(Fuzzer* fuzzer, const uint8_t* data)
+{
+    Input input = { (uint8_t*)malloc(fuzzer->len) };
+    memcpy(input.data, data, fuzzer->len);
+    da_append(&fuzzer->corpus, input);
+}
+
+void save_crash(Fuzzer* fuzzer, const uint8_t* data, HXR_Status status, uint16_t ip)
+{
+    uint32_t fault = (uint32_t)status << 16 | ip;
+    for(size_t i = 0; i < fuzzer->faults.count; ++i) {
+        if(fuzzer->faults.data[i] == fault) return;
+    }
+    da_append(&fuzzer->faults, fault);
+
+    char path[64];
+    snprintf(path, sizeof(path), "crash-%zu.bin", fuzzer->crashes);
+    FILE* f = fopen(path, "wb");
+    if(f) {
+        fwrite(data, 1, fuzzer->len, f);
+        fclose(f);
+    }
+    printf("crash: %s at ip %u, saved as %s\n", hxr_status_name(status), ip, path);
+    fuzzer->crashes += 1;
+}
+
+int main(int argc, const char** argv)
+{
+    static Fuzzer fuzzer = {0};
+    fuzzer.addr = 0x1000;
+    fuzzer.len = 64;
+    fuzzer.budget = 100000;
+    fuzzer.rng = 0x9e3779b97f4a7c15ull;
+    uint64_t max_execs = 0;
+    const char* rom = NULL;
+    da(const char*) seeds = {0};
+
+    for(int i = 1; i < argc; ++i) {
+        if(strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+            String_View spec = sv_from_cstr(argv[++i]);
+            fuzzer.addr = (uint16_t)sv_to_int(sv_chop_by_delim(&spec, ':'));
+            fuzzer.len = (uint16_t)sv_to_int(spec);
+        } else if(strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            fuzzer.budget = strtoull(argv[++i], NULL, 10);
+        } else if(strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            max_execs = strtoull(argv[++i], NULL, 10);
+        } else if(strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            fuzzer.rng = strtoull(argv[++i], NULL, 10) | 1;
+        } else if(rom == NULL) {
+            rom = argv[i];
+        } else {
+            da_append(&seeds, argv[i]);
+        }
+    }
+
+    if(rom == NULL) {
+        fprintf(stderr, "ERROR: Please provide an argument\n");
+        usage(stderr, argv[0]);
+        return 1;
+    }
+    if(fuzzer.len == 0 || (uint32_t)fuzzer.addr + fuzzer.len > HXR_ADDRESS_SPACE) {
+        fprintf(stderr, "ERROR: Input region must be inside the address space\n");
+        return 1;
+    }
+    if(fuzzer.budget == 0) fuzzer.budget = 1;
+
+    HXR* hxr = hxr_create(NULL);
+    if(!hxr || hxr_load_rom(hxr->mem, rom) != 0) {
+        fprintf(stderr, "ERROR: Failed to load ROM\n");
+        return 1;
+    }
+    static uint64_t coverage[HXR_COVERAGE_SIZE / 8];
+    static uint8_t pages[HXR_PAGE_COUNT];
+    static uint8_t snapshot[HXR_MEMORY_CAPACITY];
+    memcpy(snapshot, hxr->mem, HXR_MEMORY_CAPACITY);
+    hxr->coverage = (uint8_t*)coverage;
+    hxr->pages = pages;
+
+    uint8_t* data = (uint8_t*)calloc(fuzzer.len, 1);
+    add_input(&fuzzer, data);
+    for(size_t i = 0; i < seeds.count; ++i) {
+        FILE* f = fopen(seeds.data[i], "rb");
+        if(!f) {
+            fprintf(stderr, "ERROR: Failed to open seed %s\n", seeds.data[i]);
+            return 1;
+        }
+        memset(data, 0, fuzzer.len);
+        fread(data, 1, fuzzer.len, f);
+        fclose(f);
+        add_input(&fuzzer, data);
+    }
+
+    uint64_t start = now_ns();
+    uint64_t last_report = start;
+    uint64_t execs = 0;
+    while(max_execs == 0 || execs < max_execs) {
+        // the first pass runs every seed as is
+        Input parent = fuzzer.corpus.data[execs < fuzzer.corpus.count ? execs : rng_below(&fuzzer, fuzzer.corpus.count)];
+        memcpy(data, parent.data, fuzzer.len);
+        if(execs >= fuzzer.corpus.count) mutate(&fuzzer, data);
+
+        hxr_reset(hxr, hxr->mem, 0);
+        memcpy(&hxr->mem[fuzzer.addr], data, fuzzer.len);
+        hxr->r[1] = fuzzer.addr;
+        hxr->r[2] = fuzzer.len;
+        HXR_Status status = hxr_run(hxr, fuzzer.budget);
+        execs += 1;
+
+        if(has_new_coverage(&fuzzer, coverage, status == HXR_HALTED)) {
+            add_input(&fuzzer, data);
+        } else if(status == HXR_RUNNING) {
+            fuzzer.hangs += 1;
+        } else if(status != HXR_HALTED) {
+            save_crash(&fuzzer, data, status, hxr->ip);
+        }
+
+        // the input region is rewritten by every case, the rest comes from the snapshot
+        hxr_restore_dirty(hxr, snapshot);
+
+        uint64_t now = now_ns();
+        if(now - last_report >= 1000000000ull) {
+            last_report = now;
+            printf("%llu execs  %.0f execs/s  corpus %zu  edges %zu  crashes %zu  hangs %zu\n",
+                    (unsigned long long)execs, execs / ((now - start) / 1e9), fuzzer.corpus.count,
+                    fuzzer.edges, fuzzer.crashes, fuzzer.hangs);
+            fflush(stdout);
+        }
+    }
+
+    double seconds = (now_ns() - start) / 1e9;
+    printf("%llu execs in %.2fs (%.0f execs/s), corpus %zu, edges %zu, crashes %zu, hangs %zu\n",
+            (unsigned long long)execs, seconds, execs / seconds, fuzzer.corpus.count,
+            fuzzer.edges, fuzzer.crashes, fuzzer.hangs);
+
+    for(size_t i = 0; i < fuzzer.corpus.count; ++i) {
+        free(fuzzer.corpus.data[i].data);
+    }
+    da_free(&fuzzer.corpus);
+    da_free(&fuzzer.faults);
+    da_free(&seeds);
+    free(data);
+    hxr_destroy(hxr);
+    return fuzzer.crashes > 0;
+}
@@ -0,0 +1,90 @@
+#define _POSIX_C_SOURCE 200809L
+#include "hxr.h"
+#include "hxr_stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Samples the counters of a `hxr-emu --stats` process every interval and
+// prints the rates over that interval.
+
+void usage(FILE* f, const char* name)
+{
+    fprintf(f, "USAGE: %s [pid] [interval ms] [samples]\n", name);
+}
+
+void sum_stats(const HXR_Stats_Region* region, HXR_Stats* total)
+{
+    memset(total, 0, sizeof(*total));
+    for(uint32_t i = 0; i < region->cores && i < HXR_MAX_CORES; ++i) {
+        const HXR_Stats* core = &region->core[i];
+        total->retired += core->retired;
+        total->branches += core->branches;
+        total->taken += core->taken;
+        for(int op = 0; op < 32; ++op) {
+            total->ops[op] += core->ops[op];
+        }
+    }
+}
+
+int main(int argc, const char** argv)
+{
+    if(argc < 2) {
+        fprintf(stderr, "ERROR: Please provide an argument\n");
+        usage(stderr, argv[0]);
+        return 1;
+    }
+    int pid = atoi(argv[1]);
+    long interval = argc >= 3 ? atol(argv[2]) : 1000;
+    long samples = argc >= 4 ? atol(argv[3]) : -1;
+    if(interval <= 0) interval = 1000;
+
+    HXR_Stats_Region* region = hxr_stats_open(pid);
+    if(!region) {
+        fprintf(stderr, "ERROR: No stats published by process %d\n", pid);
+        return 1;
+    }
+
+    HXR_Stats prev, now;
+    sum_stats(region, &prev);
+    struct timespec delay = { interval / 1000, (interval % 1000) * 1000000 };
+    for(long n = 0; samples < 0 || n < samples; ++n) {
+        nanosleep(&delay, NULL);
+        sum_stats(region, &now);
+
+        double seconds = interval / 1000.0;
+        uint64_t retired = now.retired - prev.retired;
+        uint64_t loads = (now.ops[LDW] + now.ops[LDB] + now.ops[POP]) - (prev.ops[LDW] + prev.ops[LDB] + prev.ops[POP]);
+        uint64_t stores = (now.ops[STW] + now.ops[STB] + now.ops[PUSH]) - (prev.ops[STW] + prev.ops[STB] + prev.ops[PUSH]);
+        uint64_t branches = now.branches - prev.branches;
+        uint64_t taken = now.taken - prev.taken;
+        printf("%.2f MIPS  %llu retired  %llu branches (%.1f%% taken)  %llu loads  %llu stores\n",
+                retired / seconds / 1e6, (unsigned long long)now.retired, (unsigned long long)branches,
+                branches ? 100.0 * taken / branches : 0.0, (unsigned long long)loads, (unsigned long long)stores);
+
+        // top opcodes of the interval
+        printf("   ");
+        for(int top = 0; top < 5; ++top) {
+            int best = -1;
+            uint64_t best_count = 0;
+            for(int op = 0; op < 32; ++op) {
+                uint64_t count = now.ops[op] - prev.ops[op];
+                if(count > best_count) {
+                    best = op;
+                    best_count = count;
+                }
+            }
+            if(best < 0) break;
+            printf(" %s %.1f%%", hxr_opcode_name(best), 100.0 * best_count / retired);
+            // hide it from the next pass
+            prev.ops[best] = now.ops[best];
+        }
+        printf("\n");
+        fflush(stdout);
+        prev = now;
+    }
+
+    hxr_stats_close(region);
+    return 0;
+}
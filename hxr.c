@@ -9,30 +9,50 @@
     #define DEBUG_LOG(FMT, ...)
 #endif
 
-int hxr_execute(HXR* cpu, uint16_t inst)
+// Words are stored little endian in guest memory so aligned words can be
+// accessed with host atomics directly.
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+    #error "HX16 shared memory requires a little endian host"
+#endif
+
+// The load/store path translates through the TLB without a call, the build
+// does not rely on the optimizer to inline `hxr_translate`.
+#define HXR_HOST(cpu, addr) ((uint8_t*)((cpu)->tlb[(uint16_t)(addr) >> HXR_BANK_SHIFT] + (uint16_t)(addr)))
+
+const uint8_t hxr_default_cycle_costs[32] = {
+    [MOV] = 1, [MOVI] = 1, [CMP] = 1, [JE] = 2, [JN] = 2, [JL] = 2, [JG] = 2,
+    [ADD] = 1, [SUB] = 1, [MOD] = 4, [ADDI] = 1, [SUBI] = 1, [MODI] = 4,
+    [AND] = 1, [OR] = 1, [XOR] = 1, [BSL] = 1, [BSR] = 1, [BSLI] = 1, [BSRI] = 1,
+    [LDW] = 3, [STW] = 3, [LDB] = 3, [STB] = 3, [PUSH] = 3, [POP] = 3, [HALT] = 1,
+    [XCHG] = 6, [CAS] = 6, [MCPY] = 8, [MSET] = 8, [SYS] = 10,
+};
+
+// Taken branches land 2 bytes before their target because `hxr_run` advances
+// ip after every instruction.
+HXR_Status hxr_execute(HXR* cpu, uint16_t inst)
 {
-    switch(opcode(inst)) {
+    switch(hxr_opcode(inst)) {
         case MOV:
             {
-                cpu->r[ra(inst)] = cpu->r[rb(inst)];
+                cpu->r[hxr_ra(inst)] = cpu->r[hxr_rb(inst)];
                 DEBUG_LOG("Running \"%s\"\n", "MOV");
             } break;
         case MOVI:
             {
-                cpu->r[ra(inst)] = imm_8(inst);
-                DEBUG_LOG("Running \"%s\"\n r%u = %u\n", "MOVI", ra(inst), cpu->r[ra(inst)]);
+                cpu->r[hxr_ra(inst)] = hxr_imm_8(inst);
+                DEBUG_LOG("Running \"%s\"\n r%u = %u\n", "MOVI", hxr_ra(inst), cpu->r[hxr_ra(inst)]);
             } break;
         case JE:
             {
                 if(cpu->r[0] == 1) {
-                    cpu->ip = imm_11(inst);
+                    cpu->ip = hxr_branch_target(inst) - 2;
                 }
                 DEBUG_LOG("Running \"%s\"\n", "JE");
             } break;
         case JN:
             {
                 if(cpu->r[0] != 1) {
-                    cpu->ip = imm_11(inst);
+                    cpu->ip = hxr_branch_target(inst) - 2;
                 }
 
                 DEBUG_LOG("Running \"%s\"\n", "JN");
@@ -40,121 +60,120 @@ int hxr_execute(HXR* cpu, uint16_t inst)
         case JG:
             {
                 if(cpu->r[0] > 1) {
-                    cpu->ip = imm_11(inst);
+                    cpu->ip = hxr_branch_target(inst) - 2;
                 }
                 DEBUG_LOG("Running \"%s\"\n", "JG");
             } break;
         case JL:
             {
                 if((int)cpu->r[0] < 1) {
-                    cpu->ip = imm_11(inst);
+                    cpu->ip = hxr_branch_target(inst) - 2;
                 }
                 DEBUG_LOG("Running \"%s\"\n", "JL");
             } break;
         case CMP:
             {
-                uint16_t a = cpu->r[ra(inst)];
-                uint16_t b = cpu->r[rb(inst)];
+                uint16_t a = cpu->r[hxr_ra(inst)];
+                uint16_t b = cpu->r[hxr_rb(inst)];
                 cpu->r[0] = a < b ? 0 : a - b + 1;
                 DEBUG_LOG("Running \"%s\"\n", "CMP");
             } break;
         case ADD:
             {
-                cpu->r[ra(inst)] += cpu->r[rb(inst)];
+                cpu->r[hxr_ra(inst)] += cpu->r[hxr_rb(inst)];
                 DEBUG_LOG("Running \"%s\"\n", "ADD");
             } break;
         case ADDI:
             {
-                cpu->r[ra(inst)] += imm_8(inst);
+                cpu->r[hxr_ra(inst)] += hxr_imm_8(inst);
                 DEBUG_LOG("Running \"%s\"\n", "ADDI");
             } break;
         case SUB:
             {
-                cpu->r[ra(inst)] -= cpu->r[rb(inst)];
+                cpu->r[hxr_ra(inst)] -= cpu->r[hxr_rb(inst)];
                 DEBUG_LOG("Running \"%s\"\n", "SUB");
             } break;
         case SUBI:
             {
-                cpu->r[ra(inst)] -= imm_8(inst);
+                cpu->r[hxr_ra(inst)] -= hxr_imm_8(inst);
                 DEBUG_LOG("Running \"%s\"\n", "SUBI");
             } break;
         case MOD:
             {
-                cpu->r[ra(inst)] %= cpu->r[rb(inst)];
+                if(cpu->r[hxr_rb(inst)] == 0) return HXR_FAULT_DIVIDE_BY_ZERO;
+                cpu->r[hxr_ra(inst)] %= cpu->r[hxr_rb(inst)];
                 DEBUG_LOG("Running \"%s\"\n", "MOD");
             } break;
         case MODI:
             {
-                cpu->r[ra(inst)] %= imm_8(inst);
+                if(hxr_imm_8(inst) == 0) return HXR_FAULT_DIVIDE_BY_ZERO;
+                cpu->r[hxr_ra(inst)] %= hxr_imm_8(inst);
                 DEBUG_LOG("Running \"%s\"\n", "MODI");
             } break;
 
         case AND:
             {
-                cpu->r[ra(inst)] &= cpu->r[rb(inst)];
+                cpu->r[hxr_ra(inst)] &= cpu->r[hxr_rb(inst)];
                 DEBUG_LOG("Running \"%s\"\n", "AND");
             } break;
         case OR:
             {
-                cpu->r[ra(inst)] |= cpu->r[rb(inst)];
+                cpu->r[hxr_ra(inst)] |= cpu->r[hxr_rb(inst)];
                 DEBUG_LOG("Running \"%s\"\n", "OR");
             } break;
         case XOR:
             {
-                cpu->r[ra(inst)] ^= cpu->r[rb(inst)];
+                cpu->r[hxr_ra(inst)] ^= cpu->r[hxr_rb(inst)];
                 DEBUG_LOG("Running \"%s\"\n", "XOR");
             } break;
         case BSL:
             {
-                cpu->r[ra(inst)] <<= cpu->r[rb(inst)];
+                cpu->r[hxr_ra(inst)] <<= cpu->r[hxr_rb(inst)];
                 DEBUG_LOG("Running \"%s\"\n", "BSL");
             } break;
         case BSR:
             {
-                cpu->r[ra(inst)] >>= cpu->r[rb(inst)];
+                cpu->r[hxr_ra(inst)] >>= cpu->r[hxr_rb(inst)];
                 DEBUG_LOG("Running \"%s\"\n", "BSR");
             } break;
         case BSLI:
             {
-                cpu->r[ra(inst)] <<= imm_8(inst);
+                cpu->r[hxr_ra(inst)] <<= hxr_imm_8(inst);
                 DEBUG_LOG("Running \"%s\"\n", "BSLI");
             } break;
         case BSRI:
             {
-                cpu->r[ra(inst)] >>= imm_8(inst);
+                cpu->r[hxr_ra(inst)] >>= hxr_imm_8(inst);
                 DEBUG_LOG("Running \"%s\"\n", "BSRI");
             } break;
         case LDW:
             {
-                cpu->r[ra(inst)] = hxr_load(cpu, cpu->r[rb(inst)], 16);
+                cpu->r[hxr_ra(inst)] = hxr_load(cpu, cpu->r[hxr_rb(inst)], 16);
                 DEBUG_LOG("Running \"%s\"\n", "LDW");
             } break;
         case STW:
             {
-                hxr_store(cpu, cpu->r[rb(inst)], 16, cpu->r[ra(inst)]);
+                hxr_store(cpu, cpu->r[hxr_rb(inst)], 16, cpu->r[hxr_ra(inst)]);
                 DEBUG_LOG("Running \"%s\"\n", "STW");
             } break;
         case LDB:
             {
-                cpu->r[ra(inst)] = hxr_load(cpu, cpu->r[rb(inst)], 8);
+                cpu->r[hxr_ra(inst)] = hxr_load(cpu, cpu->r[hxr_rb(inst)], 8);
                 DEBUG_LOG("Running \"%s\"\n", "LDB");
             } break;
         case STB:
             {
-                hxr_store(cpu, cpu->r[rb(inst)], 8, cpu->r[ra(inst)]);
+                hxr_store(cpu, cpu->r[hxr_rb(inst)], 8, cpu->r[hxr_ra(inst)]);
                 DEBUG_LOG("Running \"%s\"\n", "STB");
             } break;
         case PUSH:
             {
-                uint16_t value = imm_11(inst);
-                cpu->mem[cpu->sp] = (uint8_t)((value >> 0) & 0xff);
-                cpu->mem[cpu->sp + 1] = (uint8_t)((value >> 8) & 0xff);
+                hxr_store_16(cpu, cpu->sp, hxr_imm_11(inst));
                 DEBUG_LOG("Running \"%s\"\n", "PSH");
             } break;
         case POP:
             {
-                uint16_t value = (cpu->mem[cpu->sp + 0] << 0) | (cpu->mem[cpu->sp + 1] << 8);
-                cpu->r[ra(inst)] = value;
+                cpu->r[hxr_ra(inst)] = hxr_load_16(cpu, cpu->sp);
                 DEBUG_LOG("Running \"%s\"\n", "POP");
             } break;
         case HALT:
@@ -162,50 +181,296 @@ int hxr_execute(HXR* cpu, uint16_t inst)
                 cpu->halt = 1;
                 DEBUG_LOG("Running \"%s\"\n", "HALT");
             } break;
-        default:
+        case XCHG:
+            {
+                if(cpu->r[hxr_rb(inst)] & 1) return HXR_FAULT_MISALIGNED;
+                cpu->r[hxr_ra(inst)] = hxr_exchange_16(cpu, cpu->r[hxr_rb(inst)], cpu->r[hxr_ra(inst)]);
+                DEBUG_LOG("Running \"%s\"\n", "XCHG");
+            } break;
+        case CAS:
+            {
+                if(cpu->r[hxr_rb(inst)] & 1) return HXR_FAULT_MISALIGNED;
+                uint16_t expected = cpu->r[0];
+                uint16_t old = hxr_compare_exchange_16(cpu, cpu->r[hxr_rb(inst)], expected, cpu->r[hxr_ra(inst)]);
+                cpu->r[hxr_ra(inst)] = old;
+                cpu->r[0] = old == expected;
+                DEBUG_LOG("Running \"%s\"\n", "CAS");
+            } break;
+        case MCPY:
             {
-                fprintf(stderr, "Unreachable\n");
-                exit(EXIT_FAILURE);
+                if(hxr_copy(cpu, cpu->r[hxr_ra(inst)], cpu->r[hxr_rb(inst)], cpu->r[0]) != 0) return HXR_FAULT_OUT_OF_BOUNDS;
+                DEBUG_LOG("Running \"%s\"\n", "MCPY");
             } break;
+        case MSET:
+            {
+                if(hxr_fill(cpu, cpu->r[hxr_ra(inst)], (uint8_t)cpu->r[hxr_rb(inst)], cpu->r[0]) != 0) return HXR_FAULT_OUT_OF_BOUNDS;
+                DEBUG_LOG("Running \"%s\"\n", "MSET");
+            } break;
+        case SYS:
+            {
+                DEBUG_LOG("Running \"%s\"\n", "SYS");
+                switch(hxr_imm_8(inst)) {
+                    case SYS_CORE_ID: cpu->r[hxr_ra(inst)] = cpu->id; break;
+                    case SYS_BREAK: return HXR_BREAK;
+                    // word 0 latches the whole counter so the other words match it
+                    case SYS_CYCLES + 0: cpu->latch[0] = cpu->cycles; // fallthrough
+                    case SYS_CYCLES + 1: case SYS_CYCLES + 2: case SYS_CYCLES + 3:
+                        {
+                            cpu->r[hxr_ra(inst)] = (uint16_t)(cpu->latch[0] >> (16 * (hxr_imm_8(inst) - SYS_CYCLES)));
+                        } break;
+                    case SYS_RETIRED + 0: cpu->latch[1] = cpu->retired; // fallthrough
+                    case SYS_RETIRED + 1: case SYS_RETIRED + 2: case SYS_RETIRED + 3:
+                        {
+                            cpu->r[hxr_ra(inst)] = (uint16_t)(cpu->latch[1] >> (16 * (hxr_imm_8(inst) - SYS_RETIRED)));
+                        } break;
+                    // while another core holds the heap lock ip stays put, so the
+                    // instruction is retried as the next step of the budget
+                    case SYS_ALLOC:
+                        {
+                            uint16_t block = hxr_heap_alloc(cpu, cpu->r[hxr_ra(inst)]);
+                            if(block == HXR_HEAP_BUSY) cpu->ip -= 2;
+                            else cpu->r[hxr_ra(inst)] = block;
+                        } break;
+                    case SYS_FREE:
+                        {
+                            int result = hxr_heap_free(cpu, cpu->r[hxr_ra(inst)]);
+                            if(result == HXR_HEAP_BUSY) cpu->ip -= 2;
+                            else if(result != 0) return HXR_FAULT_INVALID_FREE;
+                        } break;
+                    case SYS_MAP + 0: case SYS_MAP + 1: case SYS_MAP + 2: case SYS_MAP + 3:
+                        {
+                            uint16_t slot = hxr_imm_8(inst) - SYS_MAP;
+                            uint16_t old = cpu->bank[slot];
+                            if(hxr_map(cpu, slot, cpu->r[hxr_ra(inst)]) != 0) return HXR_FAULT_INVALID_BANK;
+                            cpu->r[hxr_ra(inst)] = old;
+                        } break;
+                    default:
+                        {
+                            if(!cpu->sys) return HXR_FAULT_ILLEGAL_INSTRUCTION;
+                            return cpu->sys(cpu, hxr_imm_8(inst), hxr_ra(inst), cpu->user);
+                        } break;
+                }
+            } break;
+        default: return HXR_FAULT_ILLEGAL_INSTRUCTION;
+    }
+    // an access to a watched page stops `hxr_run` after this instruction
+    return cpu->watch_hit ? HXR_BREAK : HXR_RUNNING;
+}
+
+// Slower loop used whenever something observes execution, keeping the
+// plain one free of per instruction checks.
+static HXR_Status hxr_run_instrumented(HXR* cpu, uint64_t budget)
+{
+    HXR_Stats* stats = cpu->stats;
+    uint8_t* coverage = cpu->coverage;
+    uint64_t* profile = cpu->profile;
+    for(uint64_t i = 0; budget == 0 || i < budget; ++i) {
+        if(cpu->halt) return HXR_HALTED;
+        uint16_t ip = cpu->ip;
+        uint16_t inst = hxr_fetch(cpu);
+        HXR_Status status = hxr_execute(cpu, inst);
+        if(status != HXR_RUNNING && !(status == HXR_BREAK && cpu->watch_hit)) return status;
+
+        uint16_t op = hxr_opcode(inst);
+        if(profile) profile[ip >> 1] += 1;
+        if(stats) {
+            stats->retired += 1;
+            stats->ops[op] += 1;
+            if(op >= JE && op <= JG) {
+                stats->branches += 1;
+                stats->taken += cpu->ip != ip;
+            }
+        }
+        if(coverage && op >= JE && op <= JG) {
+            coverage[(cpu->ip ^ (ip >> 1)) & (HXR_COVERAGE_SIZE - 1)] += 1;
+        }
+
+        cpu->ip += 2;
+        cpu->retired += 1;
+        cpu->cycles += cpu->costs[op];
+        if(status != HXR_RUNNING) return status;
+    }
+    return cpu->halt ? HXR_HALTED : HXR_RUNNING;
+}
+
+HXR_Status hxr_run(HXR* cpu, uint64_t budget)
+{
+    if(cpu->stats || cpu->coverage || cpu->profile) return hxr_run_instrumented(cpu, budget);
+    for(uint64_t i = 0; budget == 0 || i < budget; ++i) {
+        if(cpu->halt) return HXR_HALTED;
+        uint16_t inst = hxr_fetch(cpu);
+        HXR_Status status = hxr_execute(cpu, inst);
+        if(status != HXR_RUNNING) {
+            // a faulting instruction leaves ip pointing at itself, one that
+            // touched a watched page has completed
+            if(status != HXR_BREAK || !cpu->watch_hit) return status;
+            cpu->ip += 2;
+            cpu->retired += 1;
+            cpu->cycles += cpu->costs[hxr_opcode(inst)];
+            return status;
+        }
+        cpu->ip += 2;
+        cpu->retired += 1;
+        cpu->cycles += cpu->costs[hxr_opcode(inst)];
+    }
+    return cpu->halt ? HXR_HALTED : HXR_RUNNING;
+}
+
+const char* hxr_opcode_name(uint16_t op)
+{
+    static const char* names[32] = {
+        [MOV] = "MOV", [MOVI] = "MOVI", [CMP] = "CMP", [JE] = "JE", [JN] = "JN",
+        [JL] = "JL", [JG] = "JG", [ADD] = "ADD", [SUB] = "SUB", [MOD] = "MOD",
+        [ADDI] = "ADDI", [SUBI] = "SUBI", [MODI] = "MODI", [AND] = "AND", [OR] = "OR",
+        [XOR] = "XOR", [BSL] = "BSL", [BSR] = "BSR", [BSLI] = "BSLI", [BSRI] = "BSRI",
+        [LDW] = "LDW", [STW] = "STW", [LDB] = "LDB", [STB] = "STB", [PUSH] = "PUSH",
+        [POP] = "POP", [HALT] = "HALT", [XCHG] = "XCHG", [CAS] = "CAS", [MCPY] = "MCPY",
+        [MSET] = "MSET", [SYS] = "SYS",
+    };
+    if(op >= 32 || !names[op]) return "???";
+    return names[op];
+}
+
+const char* hxr_status_name(HXR_Status status)
+{
+    switch(status) {
+        case HXR_RUNNING: return "running";
+        case HXR_HALTED: return "halted";
+        case HXR_BREAK: return "break";
+        case HXR_FAULT_ILLEGAL_INSTRUCTION: return "illegal instruction";
+        case HXR_FAULT_DIVIDE_BY_ZERO: return "divide by zero";
+        case HXR_FAULT_MISALIGNED: return "misaligned access";
+        case HXR_FAULT_OUT_OF_BOUNDS: return "out of bounds";
+        case HXR_FAULT_INVALID_FREE: return "invalid free";
+        case HXR_FAULT_INVALID_BANK: return "invalid bank";
+        default: return "unknown";
     }
-    return 0;
 }
 
-int hxr_init(HXR* cpu, const char* filepath)
+int hxr_load_rom(uint8_t* mem, const char* filepath)
 {
     FILE* f;
-    uint8_t* result;
-    size_t sz, read_sz;
+    long sz;
+    size_t read_sz;
 
     f = fopen(filepath, "rb");
-    if(!f) return 0;
+    if(!f) return 1;
     fseek(f, 0, SEEK_END);
     sz = ftell(f);
     fseek(f, 0, SEEK_SET);
 
-    result = (uint8_t*)malloc(sz * sizeof(uint8_t));
-    if(!result) {
+    if(sz < 0 || sz > HXR_MEMORY_CAPACITY - HXR_INSTRUCTIONS_START) {
         fclose(f);
         return 1;
     }
 
-    read_sz = fread(result, sizeof(uint8_t), sz, f);
-    if(read_sz != sz) {
-        free(result);
-        fclose(f);
-        return 1;
-    }
+    read_sz = fread(&mem[HXR_INSTRUCTIONS_START], sizeof(uint8_t), sz, f);
+    fclose(f);
+    if(read_sz != (size_t)sz) return 1;
+    return 0;
+}
 
+int hxr_load_image(uint8_t* mem, const uint8_t* image, size_t size)
+{
+    if(size > HXR_MEMORY_CAPACITY - HXR_INSTRUCTIONS_START) return 1;
+    memcpy(&mem[HXR_INSTRUCTIONS_START], image, size);
+    return 0;
+}
+
+// resets the architectural state, host settings like callbacks are kept
+void hxr_reset(HXR* cpu, uint8_t* mem, uint16_t id)
+{
+    memset(cpu->r, 0, sizeof(cpu->r));
+    cpu->mem = mem;
+    cpu->id = id;
+    cpu->ip = HXR_INSTRUCTIONS_START;
     cpu->sp = 0;
     cpu->halt = 0;
-    cpu->ip = HXR_INSTRUCTIONS_START;
+    cpu->retired = 0;
+    cpu->cycles = 0;
+    memset(cpu->latch, 0, sizeof(cpu->latch));
+    for(uint16_t slot = 0; slot < HXR_BANK_SLOTS; ++slot) hxr_map(cpu, slot, slot);
+    cpu->max_frame = HXR_BANK_SLOTS - 1;
+    if(!cpu->costs) cpu->costs = hxr_default_cycle_costs;
+    memset(&cpu->heap, 0, sizeof(cpu->heap));
+}
 
-    memcpy(&cpu->mem[cpu->ip], result, read_sz);
-    free(result);
-    return 0;
+HXR* hxr_create(uint8_t* mem)
+{
+    HXR* cpu = (HXR*)calloc(1, sizeof(HXR));
+    if(!cpu) return NULL;
+    uint8_t owns_mem = mem == NULL;
+    if(owns_mem) {
+        mem = (uint8_t*)calloc(HXR_MEMORY_CAPACITY, sizeof(uint8_t));
+        if(!mem) {
+            free(cpu);
+            return NULL;
+        }
+    }
+    hxr_reset(cpu, mem, 0);
+    cpu->owns_mem = owns_mem;
+    return cpu;
+}
+
+void hxr_destroy(HXR* cpu)
+{
+    if(!cpu) return;
+    if(cpu->owns_mem) free(cpu->mem);
+    free(cpu);
 }
 
+void hxr_set_sys_callback(HXR* cpu, HXR_Sys_Callback sys, void* user)
+{
+    cpu->sys = sys;
+    cpu->user = user;
+}
+
+// Only called while page flags are in use. Writes mark their pages dirty and
+// any access to a watched page is recorded for `hxr_run` to stop on. Flags
+// belong to physical pages, so they follow the data when it is banked out.
+static void hxr_access(HXR* cpu, uint16_t addr, uint16_t size, int write)
+{
+    uint8_t watch = write ? HXR_PAGE_WATCH_WRITE : HXR_PAGE_WATCH_READ;
+    uint32_t last = ((uint32_t)addr + size - 1) >> HXR_PAGE_SHIFT;
+    for(uint32_t guest = addr >> HXR_PAGE_SHIFT; guest <= last; ++guest) {
+        uint32_t page = (hxr_translate(cpu, guest << HXR_PAGE_SHIFT) - cpu->mem) >> HXR_PAGE_SHIFT;
+        if(write) cpu->pages[page] |= HXR_PAGE_DIRTY;
+        if(cpu->pages[page] & watch) {
+            cpu->watch_hit |= watch;
+            cpu->watch_addr = addr;
+            cpu->watch_size = size;
+        }
+    }
+}
+
+// Loads and stores only test the flags of their page inline. hxr_access runs
+// for watched pages and for the first write that makes a page dirty.
+#define HXR_READ_CHECK(cpu, addr, host, size) do { \
+        if((cpu)->pages && ((cpu)->pages[((host) - (cpu)->mem) >> HXR_PAGE_SHIFT] & HXR_PAGE_WATCH_READ)) \
+            hxr_access(cpu, addr, size, 0); \
+    } while(0)
+#define HXR_WRITE_CHECK(cpu, addr, host, size) do { \
+        if((cpu)->pages && (((cpu)->pages[((host) - (cpu)->mem) >> HXR_PAGE_SHIFT] ^ HXR_PAGE_DIRTY) \
+                & (HXR_PAGE_DIRTY | HXR_PAGE_WATCH_WRITE))) \
+            hxr_access(cpu, addr, size, 1); \
+    } while(0)
+
 // memory utilities
+uint8_t* hxr_translate(HXR* cpu, uint16_t addr)
+{
+    return HXR_HOST(cpu, addr);
+}
+
+int hxr_map(HXR* cpu, uint16_t slot, uint16_t frame)
+{
+    if(slot >= HXR_BANK_SLOTS || frame >= HXR_BANK_FRAMES) return 1;
+    cpu->bank[slot] = frame;
+    // biased by the slot base so a translation needs no mask
+    cpu->tlb[slot] = (uintptr_t)cpu->mem + (uintptr_t)frame * HXR_BANK_SIZE - (uintptr_t)slot * HXR_BANK_SIZE;
+    if(frame > cpu->max_frame) cpu->max_frame = frame;
+    return 0;
+}
+
 uint16_t hxr_load(HXR* cpu, uint16_t addr, uint16_t size)
 {
     switch(size) {
@@ -217,13 +482,22 @@ uint16_t hxr_load(HXR* cpu, uint16_t addr, uint16_t size)
 
 uint16_t hxr_load_8(HXR* cpu, uint16_t addr)
 {
-    return cpu->mem[addr];
+    uint8_t* host = HXR_HOST(cpu, addr);
+    HXR_READ_CHECK(cpu, addr, host, 1);
+    return __atomic_load_n(host, __ATOMIC_RELAXED);
 }
 
 uint16_t hxr_load_16(HXR* cpu, uint16_t addr)
 {
-    return cpu->mem[addr] << 0
-         | cpu->mem[addr + 1] << 8;
+    if(addr & 1) {
+        // unaligned words are not atomic
+        return hxr_load_8(cpu, addr) << 0
+             | hxr_load_8(cpu, (uint16_t)(addr + 1)) << 8;
+    }
+    // an aligned word never crosses a page
+    uint8_t* host = HXR_HOST(cpu, addr);
+    HXR_READ_CHECK(cpu, addr, host, 2);
+    return __atomic_load_n((uint16_t*)host, __ATOMIC_ACQUIRE);
 }
 
 void hxr_store(HXR* cpu, uint16_t addr, uint16_t size, uint16_t value)
@@ -237,45 +511,234 @@ void hxr_store(HXR* cpu, uint16_t addr, uint16_t size, uint16_t value)
 
 void hxr_store_8(HXR* cpu, uint16_t addr, uint16_t value)
 {
-    cpu->mem[addr] = (uint8_t)((value >> 0) & 0xff);
+    uint8_t* host = HXR_HOST(cpu, addr);
+    HXR_WRITE_CHECK(cpu, addr, host, 1);
+    __atomic_store_n(host, (uint8_t)((value >> 0) & 0xff), __ATOMIC_RELAXED);
 }
 
 void hxr_store_16(HXR* cpu, uint16_t addr, uint16_t value)
 {
-    cpu->mem[addr] = (uint8_t)((value >> 0) & 0xff);
-    cpu->mem[addr + 1] = (uint8_t)((value >> 8) & 0xff);
+    if(addr & 1) {
+        hxr_store_8(cpu, addr, value >> 0);
+        hxr_store_8(cpu, (uint16_t)(addr + 1), value >> 8);
+        return;
+    }
+    uint8_t* host = HXR_HOST(cpu, addr);
+    HXR_WRITE_CHECK(cpu, addr, host, 2);
+    __atomic_store_n((uint16_t*)host, value, __ATOMIC_RELEASE);
+}
+
+// atomic read-modify-write, the address is aligned down to a word boundary
+uint16_t hxr_exchange_16(HXR* cpu, uint16_t addr, uint16_t value)
+{
+    uint16_t* word = (uint16_t*)HXR_HOST(cpu, addr & ~1);
+    HXR_READ_CHECK(cpu, addr & ~1, (uint8_t*)word, 2);
+    HXR_WRITE_CHECK(cpu, addr & ~1, (uint8_t*)word, 2);
+    return __atomic_exchange_n(word, value, __ATOMIC_SEQ_CST);
+}
+
+uint16_t hxr_compare_exchange_16(HXR* cpu, uint16_t addr, uint16_t expected, uint16_t desired)
+{
+    uint16_t* word = (uint16_t*)HXR_HOST(cpu, addr & ~1);
+    HXR_READ_CHECK(cpu, addr & ~1, (uint8_t*)word, 2);
+    HXR_WRITE_CHECK(cpu, addr & ~1, (uint8_t*)word, 2);
+    __atomic_compare_exchange_n(word, &expected, desired, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return expected;
+}
+
+// block operations, the whole range is checked up front so nothing is
+// written when it does not fit in the address space
+int hxr_copy(HXR* cpu, uint16_t dst, uint16_t src, uint16_t size)
+{
+    if((uint32_t)dst + size > HXR_ADDRESS_SPACE || (uint32_t)src + size > HXR_ADDRESS_SPACE) return 1;
+    if(cpu->pages && size > 0) {
+        hxr_access(cpu, src, size, 0);
+        hxr_access(cpu, dst, size, 1);
+    }
+    if(size == 0) return 0;
+    // Split at slot boundaries of either side. The pieces are copied in the
+    // direction that keeps an overlapping move within one mapping correct.
+    int backward = dst > src;
+    uint32_t done = 0;
+    while(done < size) {
+        uint32_t d = backward ? (uint32_t)dst + size - done - 1 : dst + done;
+        uint32_t s = backward ? (uint32_t)src + size - done - 1 : src + done;
+        uint32_t room_d = backward ? (d & (HXR_BANK_SIZE - 1)) + 1 : HXR_BANK_SIZE - (d & (HXR_BANK_SIZE - 1));
+        uint32_t room_s = backward ? (s & (HXR_BANK_SIZE - 1)) + 1 : HXR_BANK_SIZE - (s & (HXR_BANK_SIZE - 1));
+        uint32_t n = size - done;
+        if(n > room_d) n = room_d;
+        if(n > room_s) n = room_s;
+        if(backward) {
+            d -= n - 1;
+            s -= n - 1;
+        }
+        memmove(hxr_translate(cpu, d), hxr_translate(cpu, s), n);
+        done += n;
+    }
+    return 0;
+}
+
+int hxr_fill(HXR* cpu, uint16_t dst, uint8_t value, uint16_t size)
+{
+    if((uint32_t)dst + size > HXR_ADDRESS_SPACE) return 1;
+    if(cpu->pages && size > 0) hxr_access(cpu, dst, size, 1);
+    uint32_t end = (uint32_t)dst + size;
+    for(uint32_t at = dst; at < end;) {
+        uint32_t n = HXR_BANK_SIZE - (at & (HXR_BANK_SIZE - 1));
+        if(n > end - at) n = end - at;
+        memset(hxr_translate(cpu, at), value, n);
+        at += n;
+    }
+    return 0;
+}
+
+void hxr_restore_dirty(HXR* cpu, const uint8_t* snapshot)
+{
+    // frames past `max_frame` were never mapped, so they cannot be dirty
+    uint32_t count = (uint32_t)(cpu->max_frame + 1) << (HXR_BANK_SHIFT - HXR_PAGE_SHIFT);
+    for(uint32_t page = 0; page < count; ++page) {
+        if(!(cpu->pages[page] & HXR_PAGE_DIRTY)) continue;
+        uint32_t offset = page << HXR_PAGE_SHIFT;
+        memcpy(&cpu->mem[offset], &snapshot[offset], 1 << HXR_PAGE_SHIFT);
+        cpu->pages[page] &= ~HXR_PAGE_DIRTY;
+    }
+}
+
+// heap
+//     HXR_HEAP_BASE: lock, top, free list head per class
+//     HXR_HEAP_DATA: blocks, each one starting with its class word
+// A block is never returned to the top, freed blocks go to their class list
+// with the next pointer stored in the first payload word.
+#define HXR_HEAP_LOCK (HXR_HEAP_BASE)
+#define HXR_HEAP_TOP (HXR_HEAP_BASE + 2)
+#define HXR_HEAP_FREE(class) (HXR_HEAP_BASE + 4 + (class) * 2)
+#define HXR_HEAP_DATA (HXR_HEAP_BASE + 64)
+#define HXR_HEAP_ALLOCATED 0x8000
+
+// The heap lives in the frames that back its slots after a reset, whatever
+// the calling core has mapped, so every core shares one allocator. Heap
+// addresses are used as physical offsets and skip watches.
+static uint16_t* hxr_heap_word(HXR* cpu, uint16_t addr)
+{
+    return (uint16_t*)&cpu->mem[addr];
+}
+
+static uint16_t hxr_heap_load(HXR* cpu, uint16_t addr)
+{
+    return __atomic_load_n(hxr_heap_word(cpu, addr), __ATOMIC_ACQUIRE);
+}
+
+static void hxr_heap_store(HXR* cpu, uint16_t addr, uint16_t value)
+{
+    if(cpu->pages) cpu->pages[addr >> HXR_PAGE_SHIFT] |= HXR_PAGE_DIRTY;
+    __atomic_store_n(hxr_heap_word(cpu, addr), value, __ATOMIC_RELEASE);
+}
+
+// The lock word is guest memory, so the host never waits on it. A guest
+// that maps frame 1 could store to it and hold it forever.
+static int hxr_heap_try_lock(HXR* cpu)
+{
+    uint16_t expected = 0;
+    if(cpu->pages) cpu->pages[HXR_HEAP_LOCK >> HXR_PAGE_SHIFT] |= HXR_PAGE_DIRTY;
+    return __atomic_compare_exchange_n(hxr_heap_word(cpu, HXR_HEAP_LOCK), &expected, 1, 0,
+                                       __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+static void hxr_heap_unlock(HXR* cpu)
+{
+    hxr_heap_store(cpu, HXR_HEAP_LOCK, 0);
+}
+
+uint16_t hxr_heap_alloc(HXR* cpu, uint16_t size)
+{
+    uint16_t class = 0;
+    while(class < HXR_HEAP_CLASSES && (8u << class) - 2 < size) class += 1;
+    if(class == HXR_HEAP_CLASSES) {
+        cpu->heap.failures += 1;
+        return 0;
+    }
+
+    if(!hxr_heap_try_lock(cpu)) return HXR_HEAP_BUSY;
+    uint16_t block = hxr_heap_load(cpu, HXR_HEAP_FREE(class));
+    if(block != 0) {
+        hxr_heap_store(cpu, HXR_HEAP_FREE(class), hxr_heap_load(cpu, block + 2));
+    } else {
+        uint16_t top = hxr_heap_load(cpu, HXR_HEAP_TOP);
+        if((uint32_t)HXR_HEAP_DATA + top + (8u << class) > HXR_HEAP_END) {
+            hxr_heap_unlock(cpu);
+            cpu->heap.failures += 1;
+            return 0;
+        }
+        block = HXR_HEAP_DATA + top;
+        hxr_heap_store(cpu, HXR_HEAP_TOP, top + (8u << class));
+    }
+    hxr_heap_store(cpu, block, class | HXR_HEAP_ALLOCATED);
+    hxr_heap_unlock(cpu);
+
+    cpu->heap.allocs += 1;
+    cpu->heap.allocated += 8u << class;
+    return block + 2;
+}
+
+int hxr_heap_free(HXR* cpu, uint16_t addr)
+{
+    if(addr == 0) return 0;
+    if(addr < HXR_HEAP_DATA + 2 || addr >= HXR_HEAP_END || (addr - HXR_HEAP_DATA - 2) % 8 != 0) return 1;
+
+    uint16_t block = addr - 2;
+    if(!hxr_heap_try_lock(cpu)) return HXR_HEAP_BUSY;
+    uint16_t header = hxr_heap_load(cpu, block);
+    uint16_t class = header & ~HXR_HEAP_ALLOCATED;
+    if(!(header & HXR_HEAP_ALLOCATED) || class >= HXR_HEAP_CLASSES) {
+        hxr_heap_unlock(cpu);
+        return 1;
+    }
+    hxr_heap_store(cpu, block, class);
+    hxr_heap_store(cpu, addr, hxr_heap_load(cpu, HXR_HEAP_FREE(class)));
+    hxr_heap_store(cpu, HXR_HEAP_FREE(class), block);
+    hxr_heap_unlock(cpu);
+
+    cpu->heap.frees += 1;
+    cpu->heap.freed += 8u << class;
+    return 0;
 }
 
 // instruction decoder
-uint16_t opcode(uint16_t inst)
+uint16_t hxr_opcode(uint16_t inst)
 {
     return inst & 0x1f;
 }
 
-uint16_t ra(uint16_t inst)
+uint16_t hxr_ra(uint16_t inst)
 {
     return (inst >> 5) & 0x07;
 }
 
-uint16_t rb(uint16_t inst)
+uint16_t hxr_rb(uint16_t inst)
 {
     return (inst >> 8) & 0x07;
 }
 
-uint16_t imm_11(uint16_t inst)
+uint16_t hxr_imm_11(uint16_t inst)
 {
     return (inst >> 5) & 0x7ff;
 }
 
-uint16_t imm_8(uint16_t inst)
+uint16_t hxr_imm_8(uint16_t inst)
 {
     return (inst >> 8) & 0xff;
 }
 
+uint16_t hxr_branch_target(uint16_t inst)
+{
+    return HXR_INSTRUCTIONS_START + hxr_imm_11(inst) * 2;
+}
+
 // execution
+// ip is always even, and fetches do not count as watched reads
 uint16_t hxr_fetch(HXR* cpu)
 {
-    return hxr_load(cpu, cpu->ip, 16);
+    return __atomic_load_n((uint16_t*)HXR_HOST(cpu, cpu->ip), __ATOMIC_ACQUIRE);
 }
 
 void hxr_dump_registers(HXR* cpu)
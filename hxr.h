@@ -1,37 +1,146 @@
 #ifndef HXR_H
 #define HXR_H
 
+#include <stddef.h>
 #include <stdint.h>
 #define HXR_MEMORY_CAPACITY (1 * 1024 * 1024)
 #define HXR_INSTRUCTIONS_START (1 * 40 * 1024)
-#define HXR_HEAP_BASE (2 * 40 * 1024)
+#define HXR_HEAP_BASE (16 * 1024)
+#define HXR_HEAP_END HXR_INSTRUCTIONS_START
+#define HXR_HEAP_CLASSES 10 // blocks of 8 << class bytes, 2 of them are the header
+#define HXR_ADDRESS_SPACE (64 * 1024) // reachable with 16 bit addresses
+#define HXR_MAX_CORES 64
+#define HXR_BANK_SHIFT 14 // the address space is 4 slots of 16 KiB
+#define HXR_BANK_SIZE (1 << HXR_BANK_SHIFT)
+#define HXR_BANK_SLOTS (HXR_ADDRESS_SPACE >> HXR_BANK_SHIFT)
+#define HXR_BANK_FRAMES (HXR_MEMORY_CAPACITY >> HXR_BANK_SHIFT)
+#define HXR_PAGE_SHIFT 8
+#define HXR_PAGE_COUNT (HXR_MEMORY_CAPACITY >> HXR_PAGE_SHIFT) // pages of physical memory
+#define HXR_PAGE_DIRTY 0x01
+#define HXR_PAGE_WATCH_READ 0x02
+#define HXR_PAGE_WATCH_WRITE 0x04
+#define HXR_COVERAGE_SIZE (64 * 1024)
 
+typedef enum {
+    HXR_RUNNING = 0, // the budget ran out, call `hxr_run` again to resume
+    HXR_HALTED,
+    HXR_BREAK, // at a breakpoint, or just after an access to a watched page
+    HXR_FAULT_ILLEGAL_INSTRUCTION,
+    HXR_FAULT_DIVIDE_BY_ZERO,
+    HXR_FAULT_MISALIGNED, // XCHG/CAS on an odd address
+    HXR_FAULT_OUT_OF_BOUNDS, // MCPY/MSET past the end of the address space
+    HXR_FAULT_INVALID_FREE, // SYS_FREE of something that is not an allocated block
+    HXR_FAULT_INVALID_BANK, // SYS_MAP of a frame past HXR_MEMORY_CAPACITY
+} HXR_Status;
+
+typedef struct HXR HXR;
+
+typedef struct {
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t failures; // allocations that did not fit
+    uint64_t allocated; // bytes, headers included
+    uint64_t freed;
+} HXR_Heap_Stats;
+
+// Guest level counters, only maintained while `HXR.stats` is set
 typedef struct {
-    uint8_t mem[HXR_MEMORY_CAPACITY];
+    uint64_t retired;
+    uint64_t branches; // JE/JN/JL/JG executed
+    uint64_t taken;
+    uint64_t ops[32]; // per opcode, loads and stores are LDW/LDB/POP and STW/STB/PUSH
+} HXR_Stats;
+
+// Called for SYS functions the VM does not implement itself. `reg` is the ra
+// field of the instruction. Returning anything but HXR_RUNNING stops `hxr_run`.
+typedef HXR_Status (*HXR_Sys_Callback)(HXR* cpu, uint16_t func, uint16_t reg, void* user);
+
+// Several cores can share one memory image, each one running on its own host
+// thread. 16 bit loads and stores on even addresses are atomic.
+//
+// Guest addresses go through per core bank registers: slot `addr >> 14` maps
+// one 16 KiB frame of the HXR_MEMORY_CAPACITY bytes. `tlb` caches the host
+// address of every slot, so an access is a single lookup and aligned words
+// never straddle two slots. After a reset slot N maps frame N.
+//
+// The layout is not a stable ABI, fields move between versions. Code linking
+// libhxr.so has to be built against the hxr.h of that same build.
+struct HXR {
+    uint8_t* mem; // HXR_MEMORY_CAPACITY bytes, shared by all cores of a machine
+    uintptr_t tlb[HXR_BANK_SLOTS]; // mem + (bank[slot] - slot) * HXR_BANK_SIZE, add the full address
+    uint8_t bank[HXR_BANK_SLOTS];
+    uint8_t max_frame; // highest frame mapped since the reset
     uint16_t r[8];
     uint16_t ip; // instruction pointer
     uint16_t sp; // stack pointer
+    uint16_t id; // core id, read with `SYS ra, SYS_CORE_ID`
     uint8_t halt;
-} HXR;
+    uint8_t owns_mem;
+    uint64_t retired; // instructions executed by `hxr_run`
+    uint64_t cycles; // sum of `costs` over the retired instructions
+    const uint8_t* costs; // cycles per opcode, `hxr_default_cycle_costs` unless set
+    uint64_t latch[2]; // cycles and retired as of the last SYS_CYCLES/SYS_RETIRED + 0
+    HXR_Heap_Stats heap;
+    HXR_Stats* stats; // NULL unless counters are wanted, see `hxr_stats.h`
+    uint8_t* coverage; // HXR_COVERAGE_SIZE hit counters of JE/JN/JL/JG edges, or NULL
+    uint8_t* pages; // HXR_PAGE_COUNT physical page flags, stores set HXR_PAGE_DIRTY, or NULL
+    uint8_t watch_hit; // HXR_PAGE_WATCH_* of accesses to watched pages, cleared by the host
+    uint16_t watch_addr; // last access to a watched page, as a guest address
+    uint16_t watch_size;
+    uint64_t* profile; // HXR_ADDRESS_SPACE / 2 execution counts indexed by ip >> 1, or NULL
+    HXR_Sys_Callback sys;
+    void* user;
+};
 
 // memory utilities
+uint8_t* hxr_translate(HXR* cpu, uint16_t addr); // host pointer of a guest address
+int hxr_map(HXR* cpu, uint16_t slot, uint16_t frame);
 uint16_t hxr_load(HXR* cpu, uint16_t addr, uint16_t size);
 uint16_t hxr_load_8(HXR* cpu, uint16_t addr);
 uint16_t hxr_load_16(HXR* cpu, uint16_t addr);
 void hxr_store(HXR* cpu, uint16_t addr, uint16_t size, uint16_t value);
 void hxr_store_8(HXR* cpu, uint16_t addr, uint16_t value);
 void hxr_store_16(HXR* cpu, uint16_t addr, uint16_t value);
+uint16_t hxr_exchange_16(HXR* cpu, uint16_t addr, uint16_t value);
+uint16_t hxr_compare_exchange_16(HXR* cpu, uint16_t addr, uint16_t expected, uint16_t desired);
+int hxr_copy(HXR* cpu, uint16_t dst, uint16_t src, uint16_t size);
+int hxr_fill(HXR* cpu, uint16_t dst, uint8_t value, uint16_t size);
+// copies every page flagged dirty back from `snapshot` (HXR_MEMORY_CAPACITY
+// bytes) and clears the flag, only frames up to `max_frame` are looked at
+void hxr_restore_dirty(HXR* cpu, const uint8_t* snapshot);
+
+// Guest heap between HXR_HEAP_BASE and HXR_HEAP_END, served natively through
+// SYS_ALLOC/SYS_FREE. All of its state lives in guest memory, so it is shared by
+// the cores of a machine and an all zero region is an empty heap.
+// Both return HXR_HEAP_BUSY without doing anything while the lock is held.
+#define HXR_HEAP_BUSY 0xffff // odd, so never the address of a block
+uint16_t hxr_heap_alloc(HXR* cpu, uint16_t size); // 0 when out of memory
+int hxr_heap_free(HXR* cpu, uint16_t addr); // 1 when addr is not an allocated block
 
 // instruction decoder
-uint16_t opcode(uint16_t inst); // first 5 bit
-uint16_t ra(uint16_t inst); // 3 bit after opcode
-uint16_t rb(uint16_t inst); // 3 bit after ra
-uint16_t imm_11(uint16_t inst); // last 11 bit
-uint16_t imm_8(uint16_t inst); // last 8 bit
+uint16_t hxr_opcode(uint16_t inst); // first 5 bit
+uint16_t hxr_ra(uint16_t inst); // 3 bit after opcode
+uint16_t hxr_rb(uint16_t inst); // 3 bit after ra
+uint16_t hxr_imm_11(uint16_t inst); // last 11 bit
+uint16_t hxr_imm_8(uint16_t inst); // last 8 bit
+uint16_t hxr_branch_target(uint16_t inst); // imm_11 counts instructions from HXR_INSTRUCTIONS_START
+
+// Deterministic cost model, cycles do not depend on the speed of the host
+extern const uint8_t hxr_default_cycle_costs[32];
+
+// instances
+HXR* hxr_create(uint8_t* mem); // allocates its own memory when `mem` is NULL
+void hxr_destroy(HXR* cpu);
+void hxr_set_sys_callback(HXR* cpu, HXR_Sys_Callback sys, void* user);
 
-int hxr_init(HXR* cpu, const char* filepath);
+int hxr_load_rom(uint8_t* mem, const char* filepath);
+int hxr_load_image(uint8_t* mem, const uint8_t* image, size_t size);
+void hxr_reset(HXR* cpu, uint8_t* mem, uint16_t id);
 uint16_t hxr_fetch(HXR* cpu);
-int hxr_execute(HXR* cpu, uint16_t inst);
+HXR_Status hxr_execute(HXR* cpu, uint16_t inst);
+HXR_Status hxr_run(HXR* cpu, uint64_t budget); // budget 0 runs until halt or fault
+const char* hxr_status_name(HXR_Status status);
+const char* hxr_opcode_name(uint16_t op);
 void hxr_dump_registers(HXR* cpu);
 
 #define MOV  0x00
@@ -61,5 +170,23 @@ void hxr_dump_registers(HXR* cpu);
 #define PUSH  0x18
 #define POP  0x19
 #define HALT  0x1A
+#define XCHG 0x1B // swap ra with the word at [rb]
+#define CAS  0x1C // if [rb] == r0 then [rb] = ra, ra = old [rb], r0 = 1 on success
+#define MCPY 0x1D // copy r0 bytes from [rb] to [ra]
+#define MSET 0x1E // fill r0 bytes at [ra] with the low byte of rb
+#define SYS  0x1F // OOOOOAAAIIIIIIII, I selects the function
+
+// SYS functions
+#define SYS_CORE_ID 0x00
+#define SYS_ALLOC   0x01 // ra = address of a block of at least ra bytes, 0 on failure
+#define SYS_FREE    0x02 // releases the block at ra
+#define SYS_MAP     0x04 // +0..3, maps frame ra into that slot, ra = the previous frame
+#define SYS_CYCLES  0x10 // +0..3, ra = that 16 bit word of the cycle counter, +0 latches it
+#define SYS_RETIRED 0x14 // +0..3, ra = that 16 bit word of the retired instruction counter, +0 latches it
+#define SYS_BREAK   0xFF // stops `hxr_run` with HXR_BREAK, ip stays on it
+
+// Debuggers patch this word over an instruction to break on it, so the
+// interpreter pays nothing for breakpoints until one is hit.
+#define HXR_BREAKPOINT (SYS | SYS_BREAK << 8)
 
 #endif // HXR_H
@@ -0,0 +1,267 @@
+#include "hxr_cfg.h"
+#include <stdlib.h>
+#include <string.h>
+
+static int hxr_is_branch(uint16_t inst)
+{
+    return hxr_opcode(inst) >= JE && hxr_opcode(inst) <= JG;
+}
+
+static uint16_t hxr_cfg_addr(size_t index)
+{
+    return (uint16_t)(HXR_INSTRUCTIONS_START + index * 2);
+}
+
+size_t hxr_cfg_block_at(const HXR_Cfg* cfg, uint16_t addr)
+{
+    if(addr < HXR_INSTRUCTIONS_START || addr & 1) return HXR_CFG_NONE;
+    size_t lo = 0, hi = cfg->block_count;
+    while(lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        const HXR_Block* block = &cfg->blocks[mid];
+        if(addr < block->start) hi = mid;
+        else if(addr >= block->start + block->count * 2) lo = mid + 1;
+        else return mid;
+    }
+    return HXR_CFG_NONE;
+}
+
+int hxr_cfg_dominates(const HXR_Cfg* cfg, size_t a, size_t b)
+{
+    if(!cfg->blocks[b].reachable) return 0;
+    for(size_t block = b; block != HXR_CFG_NONE; block = cfg->blocks[block].idom) {
+        if(block == a) return 1;
+    }
+    return 0;
+}
+
+static void hxr_cfg_split(HXR_Cfg* cfg, uint8_t* leaders)
+{
+    size_t count = 0;
+    for(size_t i = 0; i < cfg->count; ++i) count += leaders[i];
+    cfg->blocks = (HXR_Block*)calloc(count, sizeof(HXR_Block));
+    cfg->block_count = 0;
+    for(size_t i = 0; i < cfg->count; ++i) {
+        if(leaders[i]) {
+            HXR_Block* block = &cfg->blocks[cfg->block_count++];
+            block->start = hxr_cfg_addr(i);
+            block->succ[0] = block->succ[1] = HXR_CFG_NONE;
+            block->idom = block->rpo = block->loop = HXR_CFG_NONE;
+        }
+        cfg->blocks[cfg->block_count - 1].count += 1;
+    }
+}
+
+static void hxr_cfg_link(HXR_Cfg* cfg)
+{
+    for(size_t b = 0; b < cfg->block_count; ++b) {
+        HXR_Block* block = &cfg->blocks[b];
+        size_t last = (block->start - HXR_INSTRUCTIONS_START) / 2 + block->count - 1;
+        uint16_t inst = cfg->code[last];
+        size_t n = 0;
+        if(hxr_opcode(inst) == HALT) {
+            block->halts = 1;
+            continue;
+        }
+        if(hxr_is_branch(inst)) {
+            block->succ[n] = hxr_cfg_block_at(cfg, hxr_branch_target(inst));
+            if(block->succ[n] != HXR_CFG_NONE) n += 1;
+            else block->falls_off = 1;
+        }
+        if(b + 1 < cfg->block_count) {
+            if(n == 0 || block->succ[0] != b + 1) block->succ[n++] = b + 1;
+        } else {
+            block->falls_off = 1;
+        }
+    }
+}
+
+static void hxr_cfg_preds(HXR_Cfg* cfg)
+{
+    cfg->pred_index = (size_t*)calloc(cfg->block_count + 1, sizeof(size_t));
+    for(size_t b = 0; b < cfg->block_count; ++b) {
+        for(int k = 0; k < 2; ++k) {
+            if(cfg->blocks[b].succ[k] != HXR_CFG_NONE) cfg->pred_index[cfg->blocks[b].succ[k] + 1] += 1;
+        }
+    }
+    for(size_t b = 0; b < cfg->block_count; ++b) {
+        cfg->pred_index[b + 1] += cfg->pred_index[b];
+    }
+    cfg->preds = (size_t*)malloc((cfg->pred_index[cfg->block_count] + 1) * sizeof(size_t));
+    size_t* fill = (size_t*)malloc(cfg->block_count * sizeof(size_t));
+    memcpy(fill, cfg->pred_index, cfg->block_count * sizeof(size_t));
+    for(size_t b = 0; b < cfg->block_count; ++b) {
+        for(int k = 0; k < 2; ++k) {
+            size_t s = cfg->blocks[b].succ[k];
+            if(s != HXR_CFG_NONE) cfg->preds[fill[s]++] = b;
+        }
+    }
+    free(fill);
+}
+
+// iterative depth first search for the reverse post order
+static void hxr_cfg_order(HXR_Cfg* cfg)
+{
+    size_t* stack = (size_t*)malloc(cfg->block_count * sizeof(size_t));
+    uint8_t* next = (uint8_t*)calloc(cfg->block_count, 1);
+    size_t* post = (size_t*)malloc(cfg->block_count * sizeof(size_t));
+    size_t top = 0, post_count = 0;
+
+    stack[top++] = 0;
+    cfg->blocks[0].reachable = 1;
+    while(top > 0) {
+        size_t b = stack[top - 1];
+        HXR_Block* block = &cfg->blocks[b];
+        if(next[b] < 2 && block->succ[next[b]] != HXR_CFG_NONE) {
+            size_t s = block->succ[next[b]++];
+            if(!cfg->blocks[s].reachable) {
+                cfg->blocks[s].reachable = 1;
+                stack[top++] = s;
+            }
+        } else {
+            post[post_count++] = b;
+            top -= 1;
+        }
+    }
+
+    cfg->order = (size_t*)malloc(post_count * sizeof(size_t));
+    cfg->order_count = post_count;
+    for(size_t i = 0; i < post_count; ++i) {
+        cfg->order[i] = post[post_count - 1 - i];
+        cfg->blocks[cfg->order[i]].rpo = i;
+    }
+    free(stack);
+    free(next);
+    free(post);
+}
+
+// "A Simple, Fast Dominance Algorithm", Cooper, Harvey and Kennedy
+static size_t hxr_cfg_intersect(HXR_Cfg* cfg, size_t a, size_t b)
+{
+    while(a != b) {
+        while(cfg->blocks[a].rpo > cfg->blocks[b].rpo) a = cfg->blocks[a].idom;
+        while(cfg->blocks[b].rpo > cfg->blocks[a].rpo) b = cfg->blocks[b].idom;
+    }
+    return a;
+}
+
+static void hxr_cfg_dominators(HXR_Cfg* cfg)
+{
+    if(cfg->order_count == 0) return;
+    cfg->blocks[0].idom = 0;
+    for(int changed = 1; changed;) {
+        changed = 0;
+        for(size_t i = 1; i < cfg->order_count; ++i) {
+            size_t b = cfg->order[i];
+            size_t idom = HXR_CFG_NONE;
+            for(size_t k = cfg->pred_index[b]; k < cfg->pred_index[b + 1]; ++k) {
+                size_t p = cfg->preds[k];
+                HXR_Block* pred = &cfg->blocks[p];
+                if(!pred->reachable || pred->idom == HXR_CFG_NONE) continue;
+                idom = idom == HXR_CFG_NONE ? p : hxr_cfg_intersect(cfg, p, idom);
+            }
+            if(cfg->blocks[b].idom != idom) {
+                cfg->blocks[b].idom = idom;
+                changed = 1;
+            }
+        }
+    }
+    cfg->blocks[0].idom = HXR_CFG_NONE;
+}
+
+static void hxr_cfg_loops(HXR_Cfg* cfg)
+{
+    size_t* stack = (size_t*)malloc(cfg->block_count * sizeof(size_t));
+    uint8_t* in_loop = (uint8_t*)calloc(cfg->block_count, 1);
+
+    // Retreating edges go to a block earlier in reverse post order. Headers
+    // are met in that order, so inner loops come later and overwrite the
+    // `loop` of their blocks. All back edges into one header form one loop.
+    for(size_t i = 0; i < cfg->order_count; ++i) {
+        size_t header = cfg->order[i];
+        HXR_Loop loop = { header, HXR_CFG_NONE, 0, 0, 0 };
+        size_t visited = 0;
+        stack[visited++] = header;
+        in_loop[header] = 1;
+        for(size_t k = cfg->pred_index[header]; k < cfg->pred_index[header + 1]; ++k) {
+            size_t latch = cfg->preds[k];
+            if(!cfg->blocks[latch].reachable || cfg->blocks[latch].rpo < cfg->blocks[header].rpo) continue;
+            if(!hxr_cfg_dominates(cfg, header, latch)) {
+                cfg->irreducible += 1;
+                continue;
+            }
+            if(loop.latches++ == 0) loop.latch = latch;
+            if(!in_loop[latch]) {
+                in_loop[latch] = 1;
+                stack[visited++] = latch;
+            }
+        }
+
+        // natural loop: the header plus everything reaching a latch without
+        // it. Every block after the header gets its predecessors added in turn.
+        for(size_t next = 1; next < visited; ++next) {
+            size_t b = stack[next];
+            for(size_t q = cfg->pred_index[b]; q < cfg->pred_index[b + 1]; ++q) {
+                size_t p = cfg->preds[q];
+                if(!cfg->blocks[p].reachable || in_loop[p]) continue;
+                in_loop[p] = 1;
+                stack[visited++] = p;
+            }
+        }
+        for(size_t v = 0; v < visited; ++v) {
+            size_t b = stack[v];
+            in_loop[b] = 0;
+            if(loop.latches == 0) continue;
+            loop.blocks += 1;
+            loop.instructions += cfg->blocks[b].count;
+            cfg->blocks[b].loop = header;
+        }
+
+        if(loop.latches > 0) {
+            cfg->loops = (HXR_Loop*)realloc(cfg->loops, (cfg->loop_count + 1) * sizeof(HXR_Loop));
+            cfg->loops[cfg->loop_count++] = loop;
+        }
+    }
+    free(stack);
+    free(in_loop);
+}
+
+int hxr_cfg_build(HXR_Cfg* cfg, const uint16_t* code, size_t count)
+{
+    memset(cfg, 0, sizeof(*cfg));
+    if(count == 0 || count > (HXR_ADDRESS_SPACE - HXR_INSTRUCTIONS_START) / 2) return 1;
+    cfg->code = code;
+    cfg->count = count;
+
+    uint8_t* leaders = (uint8_t*)calloc(count, 1);
+    if(!leaders) return 1;
+    leaders[0] = 1;
+    for(size_t i = 0; i < count; ++i) {
+        uint16_t inst = code[i];
+        if(!hxr_is_branch(inst) && hxr_opcode(inst) != HALT) continue;
+        if(i + 1 < count) leaders[i + 1] = 1;
+        if(hxr_is_branch(inst)) {
+            size_t target = (hxr_branch_target(inst) - HXR_INSTRUCTIONS_START) / 2;
+            if(target < count) leaders[target] = 1;
+        }
+    }
+    hxr_cfg_split(cfg, leaders);
+    free(leaders);
+
+    hxr_cfg_link(cfg);
+    hxr_cfg_preds(cfg);
+    hxr_cfg_order(cfg);
+    hxr_cfg_dominators(cfg);
+    hxr_cfg_loops(cfg);
+    return 0;
+}
+
+void hxr_cfg_free(HXR_Cfg* cfg)
+{
+    free(cfg->blocks);
+    free(cfg->preds);
+    free(cfg->pred_index);
+    free(cfg->order);
+    free(cfg->loops);
+    memset(cfg, 0, sizeof(*cfg));
+}
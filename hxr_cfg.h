@@ -0,0 +1,52 @@
+#ifndef HXR_CFG_H
+#define HXR_CFG_H
+
+#include "hxr.h"
+
+// Control flow graph of a ROM image loaded at HXR_INSTRUCTIONS_START. Blocks
+// end at JE/JN/JL/JG, which have the branch target and the next instruction as
+// successors, or at HALT, which has none. A block running off the end of the
+// image has no successors either and is flagged `falls_off`.
+#define HXR_CFG_NONE ((size_t)-1)
+
+typedef struct {
+    uint16_t start; // address of the first instruction
+    uint16_t count; // instructions
+    size_t succ[2]; // block indices, HXR_CFG_NONE when unused
+    size_t idom; // immediate dominator, HXR_CFG_NONE for the entry and unreachable blocks
+    size_t rpo; // reverse post order index of reachable blocks
+    size_t loop; // innermost loop header containing the block, or HXR_CFG_NONE
+    uint8_t reachable;
+    uint8_t halts;
+    uint8_t falls_off;
+} HXR_Block;
+
+typedef struct {
+    size_t header;
+    size_t latch; // source of the first back edge
+    size_t latches; // back edges into the header, all of them are in this loop
+    size_t blocks;
+    size_t instructions;
+} HXR_Loop;
+
+typedef struct {
+    const uint16_t* code;
+    size_t count; // instructions in the image
+    HXR_Block* blocks; // sorted by address, blocks[0] is the entry
+    size_t block_count;
+    size_t* preds; // predecessors of block b are preds[pred_index[b] .. pred_index[b + 1]]
+    size_t* pred_index;
+    size_t* order; // reachable blocks in reverse post order
+    size_t order_count;
+    HXR_Loop* loops;
+    size_t loop_count;
+    size_t irreducible; // retreating edges that are not back edges of a natural loop
+} HXR_Cfg;
+
+// `code` is the image as instruction words and must outlive the graph
+int hxr_cfg_build(HXR_Cfg* cfg, const uint16_t* code, size_t count);
+void hxr_cfg_free(HXR_Cfg* cfg);
+size_t hxr_cfg_block_at(const HXR_Cfg* cfg, uint16_t addr); // HXR_CFG_NONE outside the image
+int hxr_cfg_dominates(const HXR_Cfg* cfg, size_t a, size_t b);
+
+#endif // HXR_CFG_H
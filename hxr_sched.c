@@ -0,0 +1,76 @@
+#include "hxr_sched.h"
+#include <string.h>
+
+static const int hxr_sched_weight[HXR_PRIORITY_COUNT] = { 4, 2, 1 };
+
+static void hxr_sched_push(HXR_Sched* sched, HXR_Task* task)
+{
+    task->next = NULL;
+    task->ready_at = sched->clock;
+    if(sched->tail[task->priority]) {
+        sched->tail[task->priority]->next = task;
+    } else {
+        sched->head[task->priority] = task;
+    }
+    sched->tail[task->priority] = task;
+}
+
+static HXR_Task* hxr_sched_pop(HXR_Sched* sched)
+{
+    for(int pass = 0; pass < 2; ++pass) {
+        for(int p = 0; p < HXR_PRIORITY_COUNT; ++p) {
+            HXR_Task* task = sched->head[p];
+            if(!task || sched->credit[p] == 0) continue;
+            sched->credit[p] -= 1;
+            sched->head[p] = task->next;
+            if(!sched->head[p]) sched->tail[p] = NULL;
+            return task;
+        }
+        // every class with work spent its credit, start a new round
+        memcpy(sched->credit, hxr_sched_weight, sizeof(sched->credit));
+    }
+    return NULL;
+}
+
+void hxr_sched_init(HXR_Sched* sched, uint64_t slice)
+{
+    memset(sched, 0, sizeof(*sched));
+    memcpy(sched->credit, hxr_sched_weight, sizeof(sched->credit));
+    sched->slice = slice;
+}
+
+void hxr_sched_add(HXR_Sched* sched, HXR_Task* task, HXR* hxr, HXR_Priority priority)
+{
+    memset(task, 0, sizeof(*task));
+    task->hxr = hxr;
+    task->priority = priority;
+    task->status = HXR_RUNNING;
+    hxr_sched_push(sched, task);
+    sched->runnable += 1;
+}
+
+HXR_Task* hxr_sched_step(HXR_Sched* sched)
+{
+    HXR_Task* task = hxr_sched_pop(sched);
+    if(!task) return NULL;
+
+    uint64_t wait = sched->clock - task->ready_at;
+    if(wait > task->max_wait) task->max_wait = wait;
+
+    uint64_t retired = task->hxr->retired;
+    task->status = hxr_run(task->hxr, sched->slice);
+    task->slices += 1;
+    sched->clock += task->hxr->retired - retired;
+
+    if(task->status == HXR_RUNNING) {
+        hxr_sched_push(sched, task);
+    } else {
+        sched->runnable -= 1;
+    }
+    return task;
+}
+
+void hxr_sched_run(HXR_Sched* sched)
+{
+    while(hxr_sched_step(sched));
+}
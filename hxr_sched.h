@@ -0,0 +1,42 @@
+#ifndef HXR_SCHED_H
+#define HXR_SCHED_H
+
+#include "hxr.h"
+
+// Multiplexes many guests on one host thread. Every pick runs one guest for a
+// slice of instructions and puts it back at the end of its run queue. Classes
+// are picked by weight (4:2:1 per round) so low priority guests still get a
+// slice every round and the wait of any guest stays bounded.
+typedef enum {
+    HXR_PRIORITY_HIGH = 0,
+    HXR_PRIORITY_NORMAL,
+    HXR_PRIORITY_LOW,
+    HXR_PRIORITY_COUNT,
+} HXR_Priority;
+
+typedef struct HXR_Task HXR_Task;
+struct HXR_Task {
+    HXR* hxr;
+    HXR_Priority priority;
+    HXR_Status status; // last status returned by `hxr_run`
+    uint64_t slices;
+    uint64_t ready_at; // scheduler clock when the task was queued
+    uint64_t max_wait; // longest wait for a slice, in instructions run by others
+    HXR_Task* next;
+};
+
+typedef struct {
+    HXR_Task* head[HXR_PRIORITY_COUNT];
+    HXR_Task* tail[HXR_PRIORITY_COUNT];
+    int credit[HXR_PRIORITY_COUNT];
+    uint64_t slice; // instructions per slice
+    uint64_t clock; // instructions run so far by every task
+    size_t runnable;
+} HXR_Sched;
+
+void hxr_sched_init(HXR_Sched* sched, uint64_t slice);
+void hxr_sched_add(HXR_Sched* sched, HXR_Task* task, HXR* hxr, HXR_Priority priority);
+HXR_Task* hxr_sched_step(HXR_Sched* sched); // runs one slice, NULL when nothing is runnable
+void hxr_sched_run(HXR_Sched* sched); // runs until every task halted or faulted
+
+#endif // HXR_SCHED_H
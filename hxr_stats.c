@@ -0,0 +1,68 @@
+#define _POSIX_C_SOURCE 200809L
+#include "hxr_stats.h"
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+static void hxr_stats_name(char* name, size_t size, int pid)
+{
+    snprintf(name, size, "/hxr-%d", pid);
+}
+
+HXR_Stats_Region* hxr_stats_create(int pid, uint32_t cores)
+{
+    char name[32];
+    hxr_stats_name(name, sizeof(name), pid);
+
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0) return NULL;
+    if(ftruncate(fd, sizeof(HXR_Stats_Region)) != 0) {
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+    void* region = mmap(NULL, sizeof(HXR_Stats_Region), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(region == MAP_FAILED) {
+        shm_unlink(name);
+        return NULL;
+    }
+
+    HXR_Stats_Region* result = (HXR_Stats_Region*)region;
+    result->cores = cores;
+    result->magic = HXR_STATS_MAGIC;
+    return result;
+}
+
+HXR_Stats_Region* hxr_stats_open(int pid)
+{
+    char name[32];
+    hxr_stats_name(name, sizeof(name), pid);
+
+    int fd = shm_open(name, O_RDONLY, 0);
+    if(fd < 0) return NULL;
+    void* region = mmap(NULL, sizeof(HXR_Stats_Region), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(region == MAP_FAILED) return NULL;
+
+    HXR_Stats_Region* result = (HXR_Stats_Region*)region;
+    if(result->magic != HXR_STATS_MAGIC) {
+        munmap(region, sizeof(HXR_Stats_Region));
+        return NULL;
+    }
+    return result;
+}
+
+void hxr_stats_close(HXR_Stats_Region* region)
+{
+    if(region) munmap(region, sizeof(HXR_Stats_Region));
+}
+
+void hxr_stats_destroy(HXR_Stats_Region* region, int pid)
+{
+    char name[32];
+    hxr_stats_name(name, sizeof(name), pid);
+    hxr_stats_close(region);
+    shm_unlink(name);
+}
@@ -0,0 +1,23 @@
+#ifndef HXR_STATS_H
+#define HXR_STATS_H
+
+#include "hxr.h"
+
+// Counters of a running emulator published in POSIX shared memory as
+// `/hxr-<pid>` so a separate process can sample them without stopping it.
+// Every core writes its own slot with plain stores, readers may see a value
+// that is a few instructions old.
+#define HXR_STATS_MAGIC 0x53525848 // "HXRS"
+
+typedef struct {
+    uint32_t magic;
+    uint32_t cores;
+    HXR_Stats core[HXR_MAX_CORES];
+} HXR_Stats_Region;
+
+HXR_Stats_Region* hxr_stats_create(int pid, uint32_t cores);
+HXR_Stats_Region* hxr_stats_open(int pid); // read only
+void hxr_stats_close(HXR_Stats_Region* region);
+void hxr_stats_destroy(HXR_Stats_Region* region, int pid); // also removes the name
+
+#endif // HXR_STATS_H